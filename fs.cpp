@@ -1,10 +1,19 @@
 #include "fs.h"
+#include "fs_ext.h"
+#include "lz.h"
+#include "trace.h"
 
+#include <algorithm>
+#include <array>
 #include <vector>
-#include <cmath>
+#include <cstring>
 #include <fstream>
 #include <memory>
+#include <numeric>
+#include <set>
+#include <sstream>
 #include <string>
+#include <string_view>
 
 // Type Aliases
 using c8 = char;
@@ -12,14 +21,18 @@ using u8 = uint8_t;
 using i32 = int32_t;
 using usize = size_t;
 using str = std::string;
-using fd = std::fstream;
+using strv = std::string_view;
+using fd = std::iostream;
 
 // Structural Aliases
-using ParsedPathParents = std::vector<std::string>;
+// INODE::NAME as a fixed size, zero padded key, so names compare with a single memcmp
+using NameKey = std::array<c8, sizeof(INODE::NAME)>;
 
+// Views into the caller's path, nothing is copied
 struct ParsedPath {
-	str name;
-	ParsedPathParents parents;
+	strv name;      // last component
+	strv parent;    // name of the directory holding it, "/" for the root
+	strv dirPath;   // everything before the last '/'
 };
 
 struct INodeBlocks {
@@ -37,16 +50,43 @@ struct INodeBlocks {
 	unsigned char DOUBLE_INDIRECT_BLOCKS[3];
 };
 
+// The IS_DIR byte doubles as a flag field, bit 0 keeps its original meaning
+constexpr u8 INODE_FLAG_DIR = 0x01;
+// File content lives in the block pointer bytes instead of data blocks
+constexpr u8 INODE_FLAG_INLINE = 0x02;
+// Blocks hold the chunk index and the compressed chunks, SIZE is the uncompressed size
+constexpr u8 INODE_FLAG_COMPRESSED = 0x04;
+
+// DIRECT_BLOCKS, INDIRECT_BLOCKS and DOUBLE_INDIRECT_BLOCKS are contiguous
+constexpr usize INODE_INLINE_CAPACITY = sizeof(INODE::DIRECT_BLOCKS)
+	+ sizeof(INODE::INDIRECT_BLOCKS)
+	+ sizeof(INODE::DOUBLE_INDIRECT_BLOCKS);
+
+// Region offsets and block math derived from the metadata, computed once when the image is opened
+struct Geometry {
+	usize blockSize;
+	usize numBlocks;
+	usize numINodes;
+	usize bitMapSize;
+	usize iNodesOffSet;
+	usize blocksOffSet;
+	// Power of two block sizes use a shift and a mask instead of division
+	bool isPowerOfTwo;
+	usize blockShift;
+	usize blockMask;
+};
+
 struct MetaData {
 	char blockSize;
 	char numBlocks;
 	char numINodes;
+	Geometry geometry;
 };
 
 // Because the struct in fs.h was declared in a c style instead of a cpp style
 // we cannot create an actual constructor
 // The only option is this factory
-INODE INODE_factory(u8 is_used, u8 is_dir, str name, u8 size, INodeBlocks blocks) {
+INODE INODE_factory(u8 is_used, u8 is_dir, strv name, u8 size, INodeBlocks blocks) {
 	INODE inode;
 	inode.IS_USED = is_used;
 	inode.IS_DIR = is_dir;
@@ -64,6 +104,32 @@ INODE INODE_factory(u8 is_used, u8 is_dir, str name, u8 size, INodeBlocks blocks
 	return inode;
 }
 
+bool _isInline(const INODE& inode) { return (inode.IS_DIR & INODE_FLAG_INLINE) != 0; }
+
+bool _isCompressed(const INODE& inode) { return (inode.IS_DIR & INODE_FLAG_COMPRESSED) != 0; }
+
+// Packs the content into the pointer bytes, so it can go through INODE_factory
+INodeBlocks _inlineBlocks(strv content)
+{
+	INodeBlocks blocks{};
+	c8 raw[INODE_INLINE_CAPACITY]{};
+	for(usize i = 0; i < content.size() and i < INODE_INLINE_CAPACITY; i++){
+		raw[i] = content[i];
+	}
+	for(usize i = 0; i < 3; i++){
+		blocks.DIRECT_BLOCKS[i] = raw[i];
+		blocks.INDIRECT_BLOCKS[i] = raw[3 + i];
+		blocks.DOUBLE_INDIRECT_BLOCKS[i] = raw[6 + i];
+	}
+	return blocks;
+}
+
+str _readInline(const INODE& inode)
+{
+	auto raw = reinterpret_cast<const c8*>(inode.DIRECT_BLOCKS);
+	return str(raw, static_cast<u8>(inode.SIZE));
+}
+
 void truncate_file(str& fileName){ std::fstream file{fileName, std::ios::out | std::ios::trunc}; }
 
 c8 _getBitNFromByte(c8 byte, usize n){ return byte & (0x01 << n); } //(byte >> position) & 0x1
@@ -71,7 +137,7 @@ c8 _getBitNFromByte(c8 byte, usize n){ return byte & (0x01 << n); } //(byte >> p
 usize _getBitMapSize(const c8 numBlocks)
 {
 	// Rounded up to the nearest byte;
-	return std::ceil(static_cast<double>(numBlocks) / 8.0);
+	return (static_cast<u8>(numBlocks) + 7) / 8;
 }
 
 usize _getMetaDataOffSet() { return 0; }
@@ -101,34 +167,57 @@ usize _getBlocksOffSet(const c8 numBlocks, const c8 numInodes)
 		+ sizeof(c8); // Cause pointer is c8
 }
 
-usize _getBlocksOffSet(MetaData& metaData)
+Geometry _makeGeometry(const c8 blockSize, const c8 numBlocks, const c8 numInodes)
 {
-	return _getRootIndexOffSet(metaData.numBlocks, metaData.numINodes)
-		+ sizeof(c8); // Cause pointer is c8
+	Geometry geometry{};
+	geometry.blockSize = static_cast<u8>(blockSize);
+	geometry.numBlocks = static_cast<u8>(numBlocks);
+	geometry.numINodes = static_cast<u8>(numInodes);
+	geometry.bitMapSize = _getBitMapSize(numBlocks);
+	geometry.iNodesOffSet = _getINodesOffSet(numBlocks);
+	geometry.blocksOffSet = _getBlocksOffSet(numBlocks, numInodes);
+
+	geometry.isPowerOfTwo = geometry.blockSize != 0 and (geometry.blockSize & (geometry.blockSize - 1)) == 0;
+	while(geometry.isPowerOfTwo and (usize{1} << geometry.blockShift) < geometry.blockSize){
+		geometry.blockShift++;
+	}
+	geometry.blockMask = geometry.blockSize - 1;
+	return geometry;
 }
 
-usize _blocksNeededToStore(usize content, c8 blockSize)
+MetaData _makeMetaData(const c8 blockSize, const c8 numBlocks, const c8 numInodes)
 {
-	return std::ceil(static_cast<double>(content) / static_cast<double>(blockSize));
+	return { blockSize, numBlocks, numInodes, _makeGeometry(blockSize, numBlocks, numInodes) };
 }
 
-MetaData _fetchMetadata(fd& fs)
+// Index, inside the inode, of the block holding byte
+usize _blockOf(const Geometry& geometry, usize byte)
 {
-	MetaData metaData{};
-	fs.seekg(_getMetaDataOffSet())
-		.read(reinterpret_cast<char*>(&metaData), sizeof(MetaData));
-	return metaData;
+	return geometry.isPowerOfTwo ? byte >> geometry.blockShift : byte / geometry.blockSize;
 }
 
-usize _fetchBitMapSize(std::fstream& fs)
+// Position of byte inside its block
+usize _byteInBlock(const Geometry& geometry, usize byte)
 {
-	return _getBitMapSize(_fetchMetadata(fs).numBlocks);
+	return geometry.isPowerOfTwo ? byte & geometry.blockMask : byte % geometry.blockSize;
 }
 
-usize _fetchBlocksOffset(fd& fs)
+usize _blockOffSet(const Geometry& geometry, usize blockIndex)
 {
-	auto metaData = _fetchMetadata(fs);
-	return _getBlocksOffSet(metaData.numBlocks, metaData.numINodes);
+	return geometry.blocksOffSet + (geometry.isPowerOfTwo ? blockIndex << geometry.blockShift : blockIndex*geometry.blockSize);
+}
+
+usize _blocksNeededToStore(usize content, const Geometry& geometry)
+{
+	return _blockOf(geometry, content + geometry.blockSize - 1);
+}
+
+MetaData _fetchMetadata(fd& fs)
+{
+	c8 raw[3]{};
+	fs.seekg(_getMetaDataOffSet())
+		.read(raw, sizeof(raw));
+	return _makeMetaData(raw[0], raw[1], raw[2]);
 }
 
 c8 _fetchBitMapByte(fd& fs, usize byteIndex)
@@ -144,7 +233,7 @@ c8* _iNodeToWritable(INODE& inode) { return reinterpret_cast<c8*>(&inode);}
 INODE _fetchINodeByIndex(fd& fs, usize index, MetaData& metaData)
 {
 	INODE inode{};
-	fs.seekg(_getINodesOffSet(metaData.numBlocks) + index*sizeof(INODE))
+	fs.seekg(metaData.geometry.iNodesOffSet + index*sizeof(INODE))
 		.read(reinterpret_cast<char*>(&inode), sizeof(INODE));
 	return inode;
 }
@@ -153,8 +242,7 @@ c8 _fetchBlockByIndexAndOffset(fd& fs, usize index, usize offset, MetaData& meta
 {
 	c8 block{};
 	fs.seekg(
-		_getBlocksOffSet(metaData.numBlocks, metaData.numINodes)
-		+ index*metaData.blockSize
+		_blockOffSet(metaData.geometry, index)
 		+ offset*sizeof(c8)
 	).read(&block, sizeof(c8));
 	return block;
@@ -162,12 +250,12 @@ c8 _fetchBlockByIndexAndOffset(fd& fs, usize index, usize offset, MetaData& meta
 
 void _writeINodeByIndex(fd& fs, INODE inode, usize index, MetaData& metaData)
 {
-	fs.seekp(_getINodesOffSet(metaData.numBlocks) + index*sizeof(INODE))
+	fs.seekp(metaData.geometry.iNodesOffSet + index*sizeof(INODE))
 		.write(_iNodeToWritable(inode), sizeof(INODE));
 }
 
 void _writeMetaData(
-	std::fstream& fs,
+	fd& fs,
 	const MetaData& metaData
 ){
 	fs.seekp(_getMetaDataOffSet())
@@ -176,30 +264,57 @@ void _writeMetaData(
 		.write(&metaData.numINodes, sizeof(c8));
 }
 
-ParsedPath _parsePath(str& path)
+// Yields the component of path starting at position and moves position past it
+// @returns an empty view once there are no components left
+strv _nextPathComponent(strv path, usize& position)
+{
+	while(position < path.size() and path[position] == '/'){
+		position++;
+	}
+	usize start = position;
+	while(position < path.size() and path[position] != '/'){
+		position++;
+	}
+	return path.substr(start, position - start);
+}
+
+ParsedPath _parsePath(strv path)
 {
 	ParsedPath parsedPath{};
 
-	str strBuff{};
-	for(usize i = 0; i < path.size(); i++) {
-		if(path[i] == '/') {
-			// We root
-			if(strBuff.size() == 0){
-				strBuff = '/';
-			}
-			parsedPath.parents.push_back(strBuff);
-			strBuff.clear();
-		} else {
-			strBuff.push_back(path[i]);
+	// We root
+	if(!path.empty() and path[0] == '/'){
+		parsedPath.parent = "/";
+	}
+
+	usize position = 0;
+	for(auto component = _nextPathComponent(path, position); !component.empty(); component = _nextPathComponent(path, position)){
+		if(!parsedPath.name.empty()){
+			parsedPath.parent = parsedPath.name;
 		}
+		parsedPath.name = component;
 	}
-	parsedPath.name = strBuff;
+
+	auto lastSlash = path.rfind('/');
+	parsedPath.dirPath = lastSlash == strv::npos ? strv{} : path.substr(0, lastSlash);
 
 	return parsedPath;
 }
 
+NameKey _makeNameKey(strv name)
+{
+	NameKey key{};
+	std::memcpy(key.data(), name.data(), std::min(name.size(), key.size()));
+	return key;
+}
+
+bool _hasName(const INODE& inode, const NameKey& key)
+{
+	return std::memcmp(inode.NAME, key.data(), key.size()) == 0;
+}
+
 void _writeBitMap(
-	std::fstream& fs,
+	fd& fs,
 	const c8 numBlocks,
 	const std::vector<bool> bitMap,
 	const usize byteOffset
@@ -212,7 +327,7 @@ void _writeBitMap(
 }
 
 void _writeBitMapAt(
-	std::fstream& fs,
+	fd& fs,
 	const usize position,
 	const bool value
 ){
@@ -229,7 +344,7 @@ void _writeBitMapAt(
 }
 
 void _writeBitMapFill(
-	std::fstream& fs,
+	fd& fs,
 	const c8 value,
 	const c8 numBlocks,
 	const usize byteOffset
@@ -240,7 +355,7 @@ void _writeBitMapFill(
 	}
 }
 
-void _writeINodeRoot(std::fstream& fs, const c8 numInodes, const usize byteOffset)
+void _writeINodeRoot(fd& fs, const c8 numInodes, const usize byteOffset)
 {
 	INODE root{
 		0x01, // IS_USED
@@ -275,7 +390,7 @@ void _writeINodeRoot(std::fstream& fs, const c8 numInodes, const usize byteOffse
 	}
 }
 
-void _writeRootIndex(std::fstream& fs, const usize byteOffset)
+void _writeRootIndex(fd& fs, const usize byteOffset)
 {
 	c8 zeroIndex = '\0';
 	fs.seekp(byteOffset)
@@ -283,7 +398,7 @@ void _writeRootIndex(std::fstream& fs, const usize byteOffset)
 }
 
 void _writeBlocksFill(
-	std::fstream& fs,
+	fd& fs,
 	const c8 value,
 	const c8 numBlocks,
 	const c8 blockSize,
@@ -295,12 +410,12 @@ void _writeBlocksFill(
 	}
 }
 
-usize _findEmptyBlockIndex(std::fstream& fs)
+usize _findEmptyBlockIndex(fd& fs, MetaData& metaData)
 {
-	for(usize byteIndex = 0; byteIndex < _fetchBitMapSize(fs); byteIndex++){
+	for(usize byteIndex = 0; byteIndex < metaData.geometry.bitMapSize; byteIndex++){
 		c8 bitMapByte{_fetchBitMapByte(fs, byteIndex)};
-		// We now check each bit
-		for(usize bitIndex = 0; bitIndex < 8; bitIndex++){
+		// We now check each bit, the last byte may have bits past the last block
+		for(usize bitIndex = 0; bitIndex < 8 and byteIndex*8 + bitIndex < metaData.geometry.numBlocks; bitIndex++){
 			c8 bit{_getBitNFromByte(bitMapByte, bitIndex)};
 			if(bit == 0){
 				return byteIndex*8 + bitIndex;
@@ -310,31 +425,38 @@ usize _findEmptyBlockIndex(std::fstream& fs)
 	throw std::runtime_error("No free blocks");
 }
 
-INodeBlocks _writeBlocks(std::fstream& fs, str& fileContent)
+INodeBlocks _writeBlocks(fd& fs, strv fileContent, MetaData& metaData)
 {
-	auto metaData = _fetchMetadata(fs);
-	
 	INodeBlocks blocks{};
 
 	// Even if thers nothing, every directory has awlways one block
 	if(fileContent.size() == 0){
-		auto blockIndex = _findEmptyBlockIndex(fs);
+		auto blockIndex = _findEmptyBlockIndex(fs, metaData);
 		_writeBitMapAt(fs, blockIndex, 0x01);
 		blocks.DIRECT_BLOCKS[0] = blockIndex;
 		return blocks;
 	}
 	
-	auto blocksNeededToStore = _blocksNeededToStore(fileContent.size(), metaData.blockSize);
+	// Only the direct blocks are used, checked before anything is allocated
+	auto blocksNeededToStore = _blocksNeededToStore(fileContent.size(), metaData.geometry);
+	if(blocksNeededToStore > 3 /* direct blocks size */ or fileContent.size() > 0xFF /* SIZE is one byte */){
+		throw std::runtime_error("File too big");
+	}
 
 	for(usize i = 0; i < blocksNeededToStore; i++){
-		auto blockIndex = _findEmptyBlockIndex(fs);
-		auto blockOffset = _fetchBlocksOffset(fs) + blockIndex*metaData.blockSize;
-		fs.seekp(blockOffset);
-		for(usize j = 0; j < static_cast<usize>(metaData.blockSize); j++){
-			if(i*metaData.blockSize + j < fileContent.size()){
-				fs.write(&fileContent[i*metaData.blockSize + j], sizeof(c8));
+		usize blockIndex{};
+		try {
+			blockIndex = _findEmptyBlockIndex(fs, metaData);
+		} catch(const std::runtime_error&) {
+			// Running out part way must not leak the blocks already taken
+			for(usize taken = 0; taken < i; taken++){
+				_writeBitMapAt(fs, blocks.DIRECT_BLOCKS[taken], 0x00);
 			}
+			throw;
 		}
+		usize offset = i*metaData.geometry.blockSize;
+		fs.seekp(_blockOffSet(metaData.geometry, blockIndex))
+			.write(&fileContent[offset], std::min(metaData.geometry.blockSize, fileContent.size() - offset));
 		_writeBitMapAt(fs, blockIndex, 0x01);
 		blocks.DIRECT_BLOCKS[i] = blockIndex;
 	}
@@ -342,15 +464,28 @@ INodeBlocks _writeBlocks(std::fstream& fs, str& fileContent)
 	return blocks;
 }
 
+str _readBlocks(fd& fs, INODE& inode, MetaData& metaData)
+{
+	usize size = static_cast<u8>(inode.SIZE);
+	str content(size, '\0');
+	for(usize i = 0; i < _blocksNeededToStore(size, metaData.geometry); i++){
+		usize offset = i*metaData.geometry.blockSize;
+		usize length = std::min(metaData.geometry.blockSize, size - offset);
+		fs.seekg(_blockOffSet(metaData.geometry, inode.DIRECT_BLOCKS[i]))
+			.read(&content[offset], length);
+	}
+	return content;
+}
+
 // @returns the index of the new inode
 usize _writeINode(fd& fs, INODE& inode, MetaData& metaData)
 {
 	for(usize i = 0; i < static_cast<usize>(metaData.numINodes); i++){
 		INODE inodeBuff{};
-		fs.seekg(_getINodesOffSet(metaData.numBlocks) + i*sizeof(INODE))
+		fs.seekg(metaData.geometry.iNodesOffSet + i*sizeof(INODE))
 			.read(_iNodeToWritable(inodeBuff), sizeof(INODE));
 		if(inodeBuff.IS_USED == 0){
-			fs.seekp(_getINodesOffSet(metaData.numBlocks) + i*sizeof(INODE))
+			fs.seekp(metaData.geometry.iNodesOffSet + i*sizeof(INODE))
 				.write(_iNodeToWritable(inode), sizeof(INODE));
 			return i;
 		}
@@ -358,27 +493,42 @@ usize _writeINode(fd& fs, INODE& inode, MetaData& metaData)
 	throw std::runtime_error("No free space for inodes");
 }
 
-usize _findINodeIndexByName(fd& fs, str& name, MetaData& metaData)
+usize _findINodeIndexByName(fd& fs, strv name, MetaData& metaData)
 {
+	auto key = _makeNameKey(name);
 	for(usize i = 0; i < static_cast<usize>(metaData.numINodes); i++){
 		INODE inodeBuff{};
-		fs.seekg(_getINodesOffSet(metaData.numBlocks) + i*sizeof(INODE))
+		fs.seekg(metaData.geometry.iNodesOffSet + i*sizeof(INODE))
 			.read(_iNodeToWritable(inodeBuff), sizeof(INODE));
-		if(inodeBuff.IS_USED == 1 && name.compare(inodeBuff.NAME) == 0){
+		if(inodeBuff.IS_USED == 1 && _hasName(inodeBuff, key)){
 			return i;
 		}
 	}
 	throw std::runtime_error("Parent does not exist");
 }
 
-usize _findINodeOffsetByName(fd& fs, str& name, MetaData& metaData)
+usize _findINodeOffsetByName(fd& fs, strv name, MetaData& metaData)
 {
-	return _getINodesOffSet(metaData.numBlocks) + _findINodeIndexByName(fs, name, metaData)*sizeof(INODE);
+	return metaData.geometry.iNodesOffSet + _findINodeIndexByName(fs, name, metaData)*sizeof(INODE);
+}
+
+// Entries only go in the direct blocks of a directory
+void _checkDirHasRoom(const INODE& dir, MetaData& metaData)
+{
+	if(static_cast<u8>(dir.SIZE) >= 3 /* direct blocks size */ * metaData.geometry.blockSize){
+		throw std::runtime_error("Directory full");
+	}
+}
+
+// Checked before anything is allocated for the new child
+void _checkDirHasRoom(fd& fs, strv dirName, MetaData& metaData)
+{
+	_checkDirHasRoom(_fetchINodeByIndex(fs, _findINodeIndexByName(fs, dirName, metaData), metaData), metaData);
 }
 
 void _updateParentAddChild(
 	fd& fs,
-	str& parentName,
+	strv parentName,
 	usize inodeIndex,
 	INODE& inode,
 	MetaData& metaData
@@ -388,26 +538,24 @@ void _updateParentAddChild(
 	fs.seekg(parentOffset)
 		.read(_iNodeToWritable(parent), sizeof(INODE));
 
+	_checkDirHasRoom(parent, metaData);
+
 	c8 inodeIndexAsChar = inodeIndex;
 	// Cause every directory awlays has at least one block alocated
 	if(parent.SIZE == 0){
 		fs.seekp(
-			_getBlocksOffSet(metaData.numBlocks, metaData.numINodes)
-			+ metaData.blockSize*parent.DIRECT_BLOCKS[0]
+			_blockOffSet(metaData.geometry, parent.DIRECT_BLOCKS[0])
 		).write(&inodeIndexAsChar, sizeof(c8));
-	} else if(parent.SIZE % metaData.blockSize != 0) {
-		// This probably has a couple bugs, but it works
-		// auto blockWithEmptySpace = parent.DIRECT_BLOCKS[parent.SIZE];
+	} else if(_byteInBlock(metaData.geometry, parent.SIZE) != 0) {
+		auto lastBlock = parent.DIRECT_BLOCKS[_blockOf(metaData.geometry, parent.SIZE)];
 		fs.seekp(
-			_getBlocksOffSet(metaData.numBlocks, metaData.numINodes)
-			+ (parent.SIZE % metaData.blockSize)
+			_blockOffSet(metaData.geometry, lastBlock)
+			+ _byteInBlock(metaData.geometry, parent.SIZE)
 		).write(&inodeIndexAsChar, sizeof(c8));
 	} else {
 		str indexAsStr{static_cast<char>(inodeIndex)};
-		auto blocks = _writeBlocks(fs, indexAsStr);
-		for(usize i = parent.SIZE; i < 3; i++){
-			parent.DIRECT_BLOCKS[i] = blocks.DIRECT_BLOCKS[i];
-		}
+		auto blocks = _writeBlocks(fs, indexAsStr, metaData);
+		parent.DIRECT_BLOCKS[_blockOf(metaData.geometry, parent.SIZE)] = blocks.DIRECT_BLOCKS[0];
 	}
 	parent.SIZE += 1;
 
@@ -419,17 +567,10 @@ void _updateParentAddChild(
 void _removeINode(fd& fs, usize inodeIndex, MetaData& metaData)
 {
 	INODE empty_inode{};
-	fs.seekp(_getINodesOffSet(metaData.numBlocks) + inodeIndex*sizeof(INODE))
+	fs.seekp(metaData.geometry.iNodesOffSet + inodeIndex*sizeof(INODE))
 		.write(_iNodeToWritable(empty_inode), sizeof(INODE));
 }
 
-INodeBlocks _fetchINodeBlocks(fd& fs, usize inodeIndex, MetaData& metaData)
-{
-	auto iNode = _fetchINodeByIndex(fs, inodeIndex, metaData);
-	INodeBlocks blocks{iNode};
-	return blocks;
-}
-
 void _updateFreeBlocks(fd& fs, INodeBlocks& blocks, MetaData& metaData)
 {
 	for(usize i = 0; i < 3; i++){
@@ -439,65 +580,6 @@ void _updateFreeBlocks(fd& fs, INodeBlocks& blocks, MetaData& metaData)
 	}
 }
 
-void _updateParentRemoveChild(
-	fd& fs,
-	usize parentIndex,
-	usize childIndex,
-	MetaData& metaData
-){
-	INODE parent = _fetchINodeByIndex(fs, parentIndex, metaData);
-	
-	c8 childToBeRemovedBlockIndex{-1};
-	c8 childIndexInParentINode{-1};
-	bool flagExit{false};
-	for(usize blockIndex = 0; blockIndex < 3 /* direct blocks size */ && !flagExit; blockIndex++){
-		for(usize byteIndex = 0; byteIndex < static_cast<usize>(metaData.blockSize); byteIndex++){
-			fs.seekg(
-				_getBlocksOffSet(metaData.numBlocks, metaData.numINodes)
-					+ parent.DIRECT_BLOCKS[blockIndex]*metaData.blockSize
-					+ byteIndex
-			).read(&childToBeRemovedBlockIndex, sizeof(c8));
-			if(static_cast<usize>(childToBeRemovedBlockIndex) == childIndex){
-				childIndexInParentINode = blockIndex;
-				flagExit = true;
-				break;
-			}
-		}
-	}
-
-	
-	for(usize i = childIndex; i <= static_cast<usize>(parent.SIZE - 1); i++){
-		usize curBlockIndexInINode = floor(i / metaData.blockSize);
-		usize curBlockIndex = parent.DIRECT_BLOCKS[curBlockIndexInINode];
-		usize curByteIndex = i % metaData.blockSize;
-		usize curBlockOffSet = _getBlocksOffSet(metaData.numBlocks, metaData.numINodes)
-			+ curBlockIndex*metaData.blockSize
-			+ curByteIndex;
-
-		usize nextBlockIndexInINode = floor((i + 1) / metaData.blockSize);
-		usize nextBlockIndex = parent.DIRECT_BLOCKS[nextBlockIndexInINode];
-		usize nextByteIndex = (i + 1) % metaData.blockSize;
-		usize nextBlockOffSet = _getBlocksOffSet(metaData.numBlocks, metaData.numINodes)
-			+ nextBlockIndex*metaData.blockSize
-			+ nextByteIndex;
-
-		c8 next{};
-		fs.seekg(curBlockOffSet).read(&next, sizeof(c8));
-		fs.seekp(nextBlockOffSet).write(&next, sizeof(c8));
-	}
-	
-	
-	if(parent.IS_DIR != 1 and parent.SIZE != 0){
-		_writeBitMapAt(fs, parent.DIRECT_BLOCKS[static_cast<usize>(childIndexInParentINode)], 0);
-	}
-	fs.flush();
-	parent.SIZE--;
-	//parent.DIRECT_BLOCKS[childIndexInParentINode] = 0;
-	_writeINodeByIndex(fs, parent, parentIndex, metaData);
-	fs.flush();
-
-}
-
 struct _findBlockIndexInINodeReturn {
 	c8 directBlockIndex;
 	c8 byteIndex;
@@ -507,8 +589,8 @@ struct _findBlockIndexInINodeReturn {
 _findBlockIndexInINodeReturn _findBlockIndexInINode(fd& fs, INODE& iNode, c8 searchData, MetaData& metaData)
 {
 	for(c8 i = 0; i < iNode.SIZE; i++){
-		c8 directBlockIndex = i / metaData.blockSize;
-		c8 byteIndex = i % metaData.blockSize;
+		c8 directBlockIndex = _blockOf(metaData.geometry, i);
+		c8 byteIndex = _byteInBlock(metaData.geometry, i);
 		auto searchBlock = _fetchBlockByIndexAndOffset(
 			fs,
 			iNode.DIRECT_BLOCKS[static_cast<usize>(directBlockIndex)],
@@ -519,20 +601,126 @@ _findBlockIndexInINodeReturn _findBlockIndexInINode(fd& fs, INODE& iNode, c8 sea
 			return { directBlockIndex, byteIndex, i };
 		}
 	}
-	throw new std::runtime_error("Could not find block in INode");
+	throw std::runtime_error("Could not find block in INode");
 }
 
 usize _getBlockOffsetByIndexInInode(fd& fs, INODE& inode, usize index, MetaData& metaData)
 {
-	usize blockIndexInINode = index / metaData.blockSize;
+	usize blockIndexInINode = _blockOf(metaData.geometry, index);
 	usize blockIndex = inode.DIRECT_BLOCKS[blockIndexInINode];
-	usize byteIndex = index % metaData.blockSize;
-	usize blockOffSet = _getBlocksOffSet(metaData.numBlocks, metaData.numINodes)
-		+ blockIndex*metaData.blockSize
+	usize byteIndex = _byteInBlock(metaData.geometry, index);
+	usize blockOffSet = _blockOffSet(metaData.geometry, blockIndex)
 		+ byteIndex;
 	return blockOffSet;
 }
 
+// Reads length bytes starting at offset of what is stored in the inode blocks
+str _readBlockRange(fd& fs, INODE& inode, usize offset, usize length, MetaData& metaData)
+{
+	str content(length, '\0');
+	usize done = 0;
+	while(done < length){
+		usize position = offset + done;
+		usize inBlock = std::min(length - done, metaData.geometry.blockSize - _byteInBlock(metaData.geometry, position));
+		fs.seekg(_getBlockOffsetByIndexInInode(fs, inode, position, metaData))
+			.read(&content[done], inBlock);
+		done += inBlock;
+	}
+	return content;
+}
+
+// Compressed files store a chunk index followed by each chunk compressed on its own:
+//   u8 chunk count, u8 end of each chunk (relative to the first chunk), chunks
+// A chunk covers a whole number of blocks of the uncompressed content, so a ranged
+// read only reads and decompresses the chunks it touches
+constexpr usize COMPRESSION_CHUNK_TARGET = 64;
+
+usize _compressionChunkSize(const Geometry& geometry)
+{
+	return _blocksNeededToStore(COMPRESSION_CHUNK_TARGET, geometry) * geometry.blockSize;
+}
+
+usize _compressionChunkCount(usize size, const Geometry& geometry)
+{
+	usize chunkSize = _compressionChunkSize(geometry);
+	return (size + chunkSize - 1) / chunkSize;
+}
+
+// @returns an empty string when compressing would not save a block
+str _compressContent(strv content, MetaData& metaData)
+{
+	auto& geometry = metaData.geometry;
+	if(content.size() > 0xFF){
+		return "";
+	}
+
+	usize chunkSize = _compressionChunkSize(geometry);
+	usize chunkCount = _compressionChunkCount(content.size(), geometry);
+	str stored(1, static_cast<c8>(chunkCount));
+	str chunks{};
+	for(usize i = 0; i < chunkCount; i++){
+		chunks += lzCompress(content.substr(i*chunkSize, chunkSize));
+		if(chunks.size() > 0xFF){
+			return "";
+		}
+		stored.push_back(static_cast<c8>(chunks.size()));
+	}
+	stored += chunks;
+
+	usize storedBlocks = _blocksNeededToStore(stored.size(), geometry);
+	usize rawBlocks = std::max<usize>(1, _blocksNeededToStore(content.size(), geometry));
+	if(storedBlocks >= rawBlocks or storedBlocks > 3 /* direct blocks size */){
+		return "";
+	}
+	return stored;
+}
+
+str _readCompressedRange(fd& fs, INODE& inode, usize offset, usize length, MetaData& metaData)
+{
+	auto& geometry = metaData.geometry;
+	usize size = static_cast<u8>(inode.SIZE);
+	usize chunkSize = _compressionChunkSize(geometry);
+	usize chunkCount = _compressionChunkCount(size, geometry);
+	usize firstChunk = offset / chunkSize;
+	usize lastChunk = (offset + length - 1) / chunkSize;
+
+	auto index = _readBlockRange(fs, inode, 0, 1 + chunkCount, metaData);
+	auto chunkStart = [&](usize chunk){ return chunk == 0 ? 0 : static_cast<usize>(static_cast<u8>(index[chunk])); };
+	auto chunkEnd = [&](usize chunk){ return static_cast<usize>(static_cast<u8>(index[chunk + 1])); };
+
+	usize from = chunkStart(firstChunk);
+	auto compressed = _readBlockRange(fs, inode, index.size() + from, chunkEnd(lastChunk) - from, metaData);
+
+	str content{};
+	for(usize chunk = firstChunk; chunk <= lastChunk; chunk++){
+		strv chunkData = strv(compressed).substr(chunkStart(chunk) - from, chunkEnd(chunk) - chunkStart(chunk));
+		content += lzDecompress(chunkData, std::min(chunkSize, size - chunk*chunkSize));
+	}
+	return content.substr(offset - firstChunk*chunkSize, length);
+}
+
+str _readContentRange(fd& fs, INODE& inode, usize offset, usize length, MetaData& metaData)
+{
+	usize size = static_cast<u8>(inode.SIZE);
+	offset = std::min(offset, size);
+	length = std::min(length, size - offset);
+	if(length == 0){
+		return "";
+	}
+	if(_isInline(inode)){
+		return _readInline(inode).substr(offset, length);
+	}
+	if(_isCompressed(inode)){
+		return _readCompressedRange(fs, inode, offset, length, metaData);
+	}
+	return _readBlockRange(fs, inode, offset, length, metaData);
+}
+
+str _readContent(fd& fs, INODE& inode, MetaData& metaData)
+{
+	return _readContentRange(fs, inode, 0, static_cast<u8>(inode.SIZE), metaData);
+}
+
 void _updateParentMoveChildFrom(
 	fd& fs,
 	usize fromParentIndex,
@@ -563,9 +751,9 @@ Se um bloco foi desocupado, marque-o como livre no mapa de bits
 	}
 
 	// If it was the last block, we need to remove it from the bitmap
-	if(fromParent.SIZE % metaData.blockSize == 1 and fromParent.SIZE > 1){
-		_writeBitMapAt(fs, fromParent.DIRECT_BLOCKS[fromParent.SIZE / metaData.blockSize], 0);
-		fromParent.DIRECT_BLOCKS[fromParent.SIZE / metaData.blockSize] = 0x00;
+	if(_byteInBlock(metaData.geometry, fromParent.SIZE) == 1 and fromParent.SIZE > 1){
+		_writeBitMapAt(fs, fromParent.DIRECT_BLOCKS[_blockOf(metaData.geometry, fromParent.SIZE)], 0);
+		fromParent.DIRECT_BLOCKS[_blockOf(metaData.geometry, fromParent.SIZE)] = 0x00;
 		fs.flush();
 	}
 
@@ -576,7 +764,7 @@ Se um bloco foi desocupado, marque-o como livre no mapa de bits
 }
 
 bool _hasBlockWithEmptySpace(usize iNodeSize, MetaData& metaData){
-	return (iNodeSize % metaData.blockSize) > 0 or iNodeSize == 0;
+	return _byteInBlock(metaData.geometry, iNodeSize) > 0 or iNodeSize == 0;
 }
 
 void _updateParentMoveChildTo(
@@ -586,11 +774,12 @@ void _updateParentMoveChildTo(
 	MetaData& metaData
 ){
 	auto toParent = _fetchINodeByIndex(fs, toParentIndex, metaData);
+	_checkDirHasRoom(toParent, metaData);
 
 	if(!_hasBlockWithEmptySpace(toParent.SIZE, metaData)){
-		auto emptyBlockIndex = _findEmptyBlockIndex(fs);
+		auto emptyBlockIndex = _findEmptyBlockIndex(fs, metaData);
 		_writeBitMapAt(fs, emptyBlockIndex, 1);
-		auto blockIndexInINode = toParent.SIZE / metaData.blockSize;
+		auto blockIndexInINode = _blockOf(metaData.geometry, toParent.SIZE);
 		toParent.DIRECT_BLOCKS[blockIndexInINode] = emptyBlockIndex;
 	}
 
@@ -605,22 +794,12 @@ void _updateParentMoveChildTo(
 
 bool _areTheSameDirPath(const ParsedPath& path1, const ParsedPath& path2)
 {
-	if(path1.parents.size() != path2.parents.size()){
-		return false;
-	}
-	for(usize i = 0; i < path1.parents.size(); i++){
-		if(path1.parents[i] != path2.parents[i]){
-			return false;
-		}
-	}
-	return true;
+	return path1.dirPath == path2.dirPath;
 }
 
-void initFs(std::string fsFileName, int blockSize, int numBlocks, int numInodes)
+void _initFs(fd& fs, int blockSize, int numBlocks, int numInodes)
 {
-	truncate_file(fsFileName);
-	std::fstream fs{ fsFileName, std::ios::binary | std::ios::in | std::ios::out };
-	MetaData metaData{blockSize, numBlocks, numInodes};
+	auto metaData = _makeMetaData(blockSize, numBlocks, numInodes);
 	_writeMetaData(fs, metaData);
 	_writeBitMapFill(fs, 0, numBlocks, _getBitMapOffSet());
 	_writeINodeRoot(fs, numInodes, _getINodesOffSet(numBlocks));
@@ -628,73 +807,672 @@ void initFs(std::string fsFileName, int blockSize, int numBlocks, int numInodes)
 	_writeBlocksFill(fs, 0, numBlocks, blockSize, _getBlocksOffSet(numBlocks, numInodes));
 }
 
-void addFile(std::string fsFileName, std::string filePath, std::string fileContent)
+struct _PendingDir {
+	const FsTreeNode* node;
+	usize iNodeIndex;
+	INodeBlocks blocks;
+};
+
+// Lookup is by name over the whole inode table, so a name that does not fit or
+// that is already taken anywhere in the tree would make some entry unreachable
+void _checkTreeNames(const FsTreeNode& dir, std::set<str>& seen)
 {
+	for(auto& child : dir.children){
+		if(child.name.empty() or child.name.size() > sizeof(INODE::NAME) or child.name.find('/') != str::npos){
+			throw std::runtime_error("Invalid name: " + child.name);
+		}
+		if(!seen.insert(child.name).second){
+			throw std::runtime_error("Duplicate name: " + child.name);
+		}
+		_checkTreeNames(child, seen);
+	}
+}
+
+// Writes the tree into a freshly initialized image, where only the root inode and block 0 are used
+void _writeTree(fd& fs, const FsTreeNode& root, MetaData& metaData)
+{
+	auto& geometry = metaData.geometry;
+	usize nextINodeIndex = 1;
+	usize nextBlockIndex = 1;
+
+	// Blocks are handed out sequentially, so the bitmap is only written at the end
+	auto allocateBlocks = [&](usize count, INodeBlocks& blocks, usize from){
+		if(count > 3 /* direct blocks size */){
+			throw std::runtime_error("File too big");
+		}
+		for(usize i = from; i < count; i++){
+			if(nextBlockIndex >= geometry.numBlocks){
+				throw std::runtime_error("No free blocks");
+			}
+			blocks.DIRECT_BLOCKS[i] = nextBlockIndex++;
+		}
+	};
+	auto writeContent = [&](const str& content, INodeBlocks& blocks){
+		for(usize offset = 0; offset < content.size(); offset += geometry.blockSize){
+			fs.seekp(_blockOffSet(geometry, blocks.DIRECT_BLOCKS[_blockOf(geometry, offset)]))
+				.write(&content[offset], std::min(geometry.blockSize, content.size() - offset));
+		}
+	};
+
+	// Breadth first, so the children of a directory get adjacent inodes and blocks
+	std::vector<_PendingDir> pending{};
+	INodeBlocks rootBlocks{};
+	allocateBlocks(std::max<usize>(1, _blocksNeededToStore(root.children.size(), geometry)), rootBlocks, 1);
+	pending.push_back({&root, 0, rootBlocks});
+
+	for(usize next = 0; next < pending.size(); next++){
+		auto dir = pending[next];
+		auto& children = dir.node->children;
+		if(nextINodeIndex + children.size() > geometry.numINodes){
+			throw std::runtime_error("No free space for inodes");
+		}
+
+		str entries{};
+		usize firstChildIndex = nextINodeIndex;
+		nextINodeIndex += children.size();
+		for(usize i = 0; i < children.size(); i++){
+			auto& child = children[i];
+			usize childIndex = firstChildIndex + i;
+			entries.push_back(static_cast<c8>(childIndex));
+
+			INodeBlocks childBlocks{};
+			if(child.isDir){
+				allocateBlocks(std::max<usize>(1, _blocksNeededToStore(child.children.size(), geometry)), childBlocks, 0);
+				pending.push_back({&child, childIndex, childBlocks});
+				continue;
+			}
+			if(child.content.size() > 0xFF){
+				throw std::runtime_error("File too big");
+			}
+			allocateBlocks(std::max<usize>(1, _blocksNeededToStore(child.content.size(), geometry)), childBlocks, 0);
+			writeContent(child.content, childBlocks);
+			_writeINodeByIndex(fs, INODE_factory(1, 0, child.name, child.content.size(), childBlocks), childIndex, metaData);
+		}
+
+		writeContent(entries, dir.blocks);
+		strv name = dir.iNodeIndex == 0 ? strv{"/"} : strv{dir.node->name};
+		_writeINodeByIndex(fs, INODE_factory(1, INODE_FLAG_DIR, name, children.size(), dir.blocks), dir.iNodeIndex, metaData);
+	}
+
+	std::vector<c8> bitMap(geometry.bitMapSize, 0);
+	for(usize i = 0; i < nextBlockIndex; i++){
+		bitMap[i / 8] |= 0x01 << (i % 8);
+	}
+	fs.seekp(_getBitMapOffSet()).write(bitMap.data(), bitMap.size());
+}
+
+void initFs(std::string fsFileName, int blockSize, int numBlocks, int numInodes)
+{
+	traceRecord("initFs", {fsFileName, std::to_string(blockSize), std::to_string(numBlocks), std::to_string(numInodes)});
+	truncate_file(fsFileName);
 	std::fstream fs{ fsFileName, std::ios::binary | std::ios::in | std::ios::out };
+	_initFs(fs, blockSize, numBlocks, numInodes);
+}
+
+// Path and content of every entry, parents first, see trace.h
+void _traceTreeArgs(const FsTreeNode& dir, const str& prefix, std::vector<str>& args)
+{
+	for(auto& child : dir.children){
+		args.push_back(prefix + child.name + (child.isDir ? "/" : ""));
+		args.push_back(child.content);
+		if(child.isDir){
+			_traceTreeArgs(child, prefix + child.name + "/", args);
+		}
+	}
+}
+
+void initFs(std::string fsFileName, int blockSize, int numBlocks, int numInodes, const FsTreeNode& root)
+{
+	std::vector<str> traceArgs{fsFileName, std::to_string(blockSize), std::to_string(numBlocks), std::to_string(numInodes)};
+	_traceTreeArgs(root, "", traceArgs);
+	traceRecord("initFs", traceArgs);
+
+	std::set<str> names{"/"}; // The root
+	_checkTreeNames(root, names);
+
+	// The whole image is built in memory first
+	std::stringstream image{ std::ios::binary | std::ios::in | std::ios::out };
+	_initFs(image, blockSize, numBlocks, numInodes);
+	auto metaData = _fetchMetadata(image);
+	_writeTree(image, root, metaData);
+
+	std::ofstream file{ fsFileName, std::ios::binary | std::ios::trunc };
+	auto content = image.str();
+	file.write(content.data(), content.size());
+}
+
+void addFile(std::iostream& fs, std::string_view filePath, std::string_view fileContent)
+{
 	auto metaData = _fetchMetadata(fs);
-	
-	auto blocksIndex = _writeBlocks(fs, fileContent);
 	auto fileStructure = _parsePath(filePath);
+	_checkDirHasRoom(fs, fileStructure.parent, metaData);
+
+	auto blocksIndex = _writeBlocks(fs, fileContent, metaData);
 	auto inode = INODE_factory(1, 0, fileStructure.name, fileContent.size(), blocksIndex);
 	auto inodeIndex = _writeINode(fs, inode, metaData);
 
-	_updateParentAddChild(fs, fileStructure.parents.back(), inodeIndex, inode, metaData);
+	_updateParentAddChild(fs, fileStructure.parent, inodeIndex, inode, metaData);
 }
 
-void addDir(std::string fsFileName, std::string dirPath)
+void addFile(std::iostream& fs, std::string_view filePath, std::string_view fileContent, FileOptions options)
+{
+	auto metaData = _fetchMetadata(fs);
+	auto fileStructure = _parsePath(filePath);
+	_checkDirHasRoom(fs, fileStructure.parent, metaData);
+
+	INODE inode{};
+	str stored{};
+	if(options.inlineData and fileContent.size() <= INODE_INLINE_CAPACITY){
+		inode = INODE_factory(1, INODE_FLAG_INLINE, fileStructure.name, fileContent.size(), _inlineBlocks(fileContent));
+	} else if(options.compress and !(stored = _compressContent(fileContent, metaData)).empty()){
+		auto blocksIndex = _writeBlocks(fs, stored, metaData);
+		inode = INODE_factory(1, INODE_FLAG_COMPRESSED, fileStructure.name, fileContent.size(), blocksIndex);
+	} else {
+		addFile(fs, filePath, fileContent);
+		return;
+	}
+	auto inodeIndex = _writeINode(fs, inode, metaData);
+
+	_updateParentAddChild(fs, fileStructure.parent, inodeIndex, inode, metaData);
+}
+
+std::string readFile(std::iostream& fs, std::string_view filePath)
+{
+	auto metaData = _fetchMetadata(fs);
+
+	auto fileStructure = _parsePath(filePath);
+	auto inode = _fetchINodeByIndex(fs, _findINodeIndexByName(fs, fileStructure.name, metaData), metaData);
+	if((inode.IS_DIR & INODE_FLAG_DIR) != 0){
+		throw std::runtime_error("Path is a directory");
+	}
+	return _readContent(fs, inode, metaData);
+}
+
+std::string readAt(std::iostream& fs, std::string_view filePath, int offset, int length)
+{
+	if(offset < 0 or length < 0){
+		throw std::runtime_error("Negative offset or length");
+	}
+
+	auto metaData = _fetchMetadata(fs);
+
+	auto fileStructure = _parsePath(filePath);
+	auto inode = _fetchINodeByIndex(fs, _findINodeIndexByName(fs, fileStructure.name, metaData), metaData);
+	if((inode.IS_DIR & INODE_FLAG_DIR) != 0){
+		throw std::runtime_error("Path is a directory");
+	}
+	return _readContentRange(fs, inode, offset, length, metaData);
+}
+
+void _writeAt(fd& fs, usize inodeIndex, INODE& inode, usize offset, strv bytes, MetaData& metaData)
+{
+	if((inode.IS_DIR & INODE_FLAG_DIR) != 0){
+		throw std::runtime_error("Path is a directory");
+	}
+
+	usize size = static_cast<u8>(inode.SIZE);
+	str padded{};
+	if(offset > size){
+		// Holes are not supported, so the gap is written as zeros
+		padded.assign(offset - size, '\0');
+		padded += bytes;
+		bytes = padded;
+		offset = size;
+	}
+	if(bytes.empty()){
+		return;
+	}
+
+	usize newSize = std::max(size, offset + bytes.size());
+	usize maxRawSize = 3 /* direct blocks size */ * metaData.geometry.blockSize;
+	if(newSize > 0xFF){
+		throw std::runtime_error("File too big");
+	}
+
+	// Inline and compressed content is not positional, so it is rewritten as a whole
+	if(_isInline(inode) or _isCompressed(inode)){
+		strv name(inode.NAME, strnlen(inode.NAME, sizeof(INODE::NAME)));
+		auto content = _readContent(fs, inode, metaData);
+		content.resize(newSize);
+		content.replace(offset, bytes.size(), bytes);
+		if(_isInline(inode) and newSize <= INODE_INLINE_CAPACITY){
+			inode = INODE_factory(1, inode.IS_DIR, name, newSize, _inlineBlocks(content));
+			_writeINodeByIndex(fs, inode, inodeIndex, metaData);
+			return;
+		}
+
+		// An inline file that outgrew the inode spills to plain data blocks
+		u8 flags = inode.IS_DIR & ~(INODE_FLAG_INLINE | INODE_FLAG_COMPRESSED);
+		auto stored = _isCompressed(inode) ? _compressContent(content, metaData) : str{};
+		if(!stored.empty()){
+			flags |= INODE_FLAG_COMPRESSED;
+		} else if(newSize > maxRawSize){
+			throw std::runtime_error("File too big");
+		} else {
+			stored = content;
+		}
+		// The old blocks are only released once the new content is written, a rewrite
+		// that runs out of blocks leaves the file as it was
+		auto newBlocks = _writeBlocks(fs, stored, metaData);
+		if(_isCompressed(inode)){
+			INodeBlocks oldBlocks{inode};
+			_updateFreeBlocks(fs, oldBlocks, metaData);
+		}
+		inode = INODE_factory(1, flags, name, newSize, newBlocks);
+		_writeINodeByIndex(fs, inode, inodeIndex, metaData);
+		return;
+	}
+
+	if(newSize > maxRawSize){
+		throw std::runtime_error("File too big");
+	}
+
+	// Files always own at least one block, even when empty
+	usize allocatedBlocks = std::max<usize>(1, _blocksNeededToStore(size, metaData.geometry));
+	usize firstBlock = _blockOf(metaData.geometry, offset);
+	usize lastBlock = _blockOf(metaData.geometry, offset + bytes.size() - 1);
+	for(usize blockIndexInINode = firstBlock; blockIndexInINode <= lastBlock; blockIndexInINode++){
+		if(blockIndexInINode >= allocatedBlocks){
+			auto blockIndex = _findEmptyBlockIndex(fs, metaData);
+			_writeBitMapAt(fs, blockIndex, 0x01);
+			inode.DIRECT_BLOCKS[blockIndexInINode] = blockIndex;
+		}
+
+		// Only the slice of the head and tail blocks that changed is written
+		usize from = std::max(offset, blockIndexInINode*metaData.geometry.blockSize);
+		usize to = std::min(offset + bytes.size(), (blockIndexInINode + 1)*metaData.geometry.blockSize);
+		fs.seekp(_getBlockOffsetByIndexInInode(fs, inode, from, metaData))
+			.write(&bytes[from - offset], to - from);
+	}
+
+	inode.SIZE = newSize;
+	_writeINodeByIndex(fs, inode, inodeIndex, metaData);
+}
+
+void writeAt(std::iostream& fs, std::string_view filePath, int offset, std::string_view bytes)
+{
+	if(offset < 0){
+		throw std::runtime_error("Negative offset");
+	}
+
+	auto metaData = _fetchMetadata(fs);
+
+	auto fileStructure = _parsePath(filePath);
+	auto inodeIndex = _findINodeIndexByName(fs, fileStructure.name, metaData);
+	auto inode = _fetchINodeByIndex(fs, inodeIndex, metaData);
+	_writeAt(fs, inodeIndex, inode, offset, bytes, metaData);
+}
+
+void append(std::iostream& fs, std::string_view filePath, std::string_view bytes)
+{
+	auto metaData = _fetchMetadata(fs);
+
+	auto fileStructure = _parsePath(filePath);
+	auto inodeIndex = _findINodeIndexByName(fs, fileStructure.name, metaData);
+	auto inode = _fetchINodeByIndex(fs, inodeIndex, metaData);
+	_writeAt(fs, inodeIndex, inode, static_cast<u8>(inode.SIZE), bytes, metaData);
+}
+
+void addDir(std::iostream& fs, std::string_view dirPath)
 {
-	std::fstream fs{ fsFileName, std::ios::binary | std::ios::in | std::ios::out };
 	auto metaData = _fetchMetadata(fs);
 
 
-	str empty{""}; // Cause every directory must have at least one block alocated
-	auto blocksIndex = _writeBlocks(fs, empty);
-	
 	auto dirStructure = _parsePath(dirPath);
+	_checkDirHasRoom(fs, dirStructure.parent, metaData);
+
+	str empty{""}; // Cause every directory must have at least one block alocated
+	auto blocksIndex = _writeBlocks(fs, empty, metaData);
 	auto inode = INODE_factory(1, 1, dirStructure.name,	0, blocksIndex);
 	auto inodeIndex = _writeINode(fs, inode, metaData);
 
-	_updateParentAddChild(fs, dirStructure.parents.back(), inodeIndex, inode, metaData);
+	_updateParentAddChild(fs, dirStructure.parent, inodeIndex, inode, metaData);
 }
 
-void remove(std::string fsFileName, std::string path)
+void remove(std::iostream& fs, std::string_view path)
 {
-	std::fstream fs{ fsFileName, std::ios::binary | std::ios::in | std::ios::out };
 	auto metaData = _fetchMetadata(fs);
 
 	auto dirStructure = _parsePath(path);
 	auto iNodeIndex = _findINodeIndexByName(fs, dirStructure.name, metaData);
-	auto iNodeBlocks = _fetchINodeBlocks(fs, iNodeIndex, metaData);
-	_updateFreeBlocks(fs, iNodeBlocks, metaData);
+	auto iNode = _fetchINodeByIndex(fs, iNodeIndex, metaData);
+	// Inline files hold data, not block indexes, in their pointers
+	if(!_isInline(iNode)){
+		INodeBlocks iNodeBlocks{iNode};
+		_updateFreeBlocks(fs, iNodeBlocks, metaData);
+	}
 	_removeINode(fs, iNodeIndex, metaData);
 
-	auto parentName = dirStructure.parents.back();
-	_updateParentRemoveChild(fs, _findINodeIndexByName(fs, parentName, metaData), iNodeIndex, metaData);
+	auto parentName = dirStructure.parent;
+	_updateParentMoveChildFrom(fs, _findINodeIndexByName(fs, parentName, metaData), iNodeIndex, metaData);
 }
 
-void move(std::string fsFileName, std::string oldPath, std::string newPath)
+void move(std::iostream& fs, std::string_view oldPath, std::string_view newPath)
 {
-	std::fstream fs{ fsFileName, std::ios::binary | std::ios::in | std::ios::out };
 	auto metaData = _fetchMetadata(fs);
 
 	auto newDirStructure = _parsePath(newPath);
-	auto newParentIndex = _findINodeIndexByName(fs, newDirStructure.parents.back(), metaData);
+	auto newParentIndex = _findINodeIndexByName(fs, newDirStructure.parent, metaData);
 	//auto newParent = _fetchINodeByIndex(fs, newParentIndex, metaData);
 
 	auto oldDirStructure = _parsePath(oldPath);
-	auto oldParentIndex = _findINodeIndexByName(fs, oldDirStructure.parents.back(), metaData);
+	auto oldParentIndex = _findINodeIndexByName(fs, oldDirStructure.parent, metaData);
 	//auto oldParent = _fetchINodeByIndex(fs, oldParentIndex, metaData);
 	
 	auto movedFileIndex = _findINodeIndexByName(fs, oldDirStructure.name, metaData);
 
 	if(!_areTheSameDirPath(oldDirStructure, newDirStructure)){
+		_checkDirHasRoom(_fetchINodeByIndex(fs, newParentIndex, metaData), metaData);
 		_updateParentMoveChildFrom(fs, oldParentIndex, movedFileIndex, metaData);
 		_updateParentMoveChildTo(fs, newParentIndex, movedFileIndex, metaData);
 	}
 
 	auto movedFile = _fetchINodeByIndex(fs, movedFileIndex, metaData);
-	for(usize i = 0; i < newDirStructure.name.size() and i < 10; i++){
-		movedFile.NAME[i] = newDirStructure.name[i];
-	}
+	// Zero padded, a shorter name must not keep the tail of the old one
+	auto newName = _makeNameKey(newDirStructure.name);
+	std::memcpy(movedFile.NAME, newName.data(), newName.size());
 	_writeINodeByIndex(fs, movedFile, movedFileIndex, metaData);
 }
+
+struct _TreeEntry {
+	str path;
+	INODE iNode;
+};
+
+// Breadth first walk from the root inode, skipping dangling or repeated entries
+std::vector<_TreeEntry> _walkTree(fd& fs, MetaData& metaData)
+{
+	std::vector<_TreeEntry> entries{};
+	std::vector<bool> seen(static_cast<u8>(metaData.numINodes), false);
+	seen[0] = true;
+
+	auto root = _fetchINodeByIndex(fs, 0, metaData);
+	entries.push_back({"", root});
+	for(usize next = 0; next < entries.size(); next++){
+		auto dir = entries[next];
+		if((dir.iNode.IS_DIR & INODE_FLAG_DIR) == 0){
+			continue;
+		}
+		for(c8 child : _readBlocks(fs, dir.iNode, metaData)){
+			usize childIndex = static_cast<u8>(child);
+			if(childIndex >= seen.size() or seen[childIndex]){
+				continue;
+			}
+			auto childINode = _fetchINodeByIndex(fs, childIndex, metaData);
+			if(childINode.IS_USED != 1){
+				continue;
+			}
+			seen[childIndex] = true;
+			str name(childINode.NAME, strnlen(childINode.NAME, sizeof(INODE::NAME)));
+			// Paths are handed to exporters that write to the host, they must stay below the root
+			if(name.empty() or name == "." or name == ".." or name.find('/') != str::npos){
+				throw std::runtime_error("Invalid name in image: " + name);
+			}
+			entries.push_back({dir.path.empty() ? name : dir.path + "/" + name, childINode});
+		}
+	}
+	entries.erase(entries.begin()); // The root
+	return entries;
+}
+
+void exportFs(std::iostream& fs, const std::function<void(const FsEntry&)>& visit)
+{
+	auto metaData = _fetchMetadata(fs);
+	auto entries = _walkTree(fs, metaData);
+
+	std::vector<_TreeEntry*> files{};
+	for(auto& entry : entries){
+		if((entry.iNode.IS_DIR & INODE_FLAG_DIR) != 0){
+			visit({entry.path, true, ""});
+		} else {
+			files.push_back(&entry);
+		}
+	}
+
+	// Inline files need no block reads, the rest go in physical block order
+	std::stable_sort(files.begin(), files.end(), [](_TreeEntry* a, _TreeEntry* b){
+		int aBlock = _isInline(a->iNode) ? -1 : a->iNode.DIRECT_BLOCKS[0];
+		int bBlock = _isInline(b->iNode) ? -1 : b->iNode.DIRECT_BLOCKS[0];
+		return aBlock < bBlock;
+	});
+	for(auto file : files){
+		auto content = _readContent(fs, file->iNode, metaData);
+		visit({file->path, false, content});
+	}
+}
+
+// Reads the records of sorted, unique inode indexes, adjacent records are fetched
+// with a single read
+std::vector<INODE> _fetchINodesByIndex(fd& fs, const std::vector<usize>& indexes, MetaData& metaData)
+{
+	std::vector<INODE> inodes(indexes.size());
+	for(usize first = 0; first < indexes.size();){
+		usize last = first;
+		while(last + 1 < indexes.size() and indexes[last + 1] == indexes[last] + 1){
+			last++;
+		}
+		fs.seekg(metaData.geometry.iNodesOffSet + indexes[first]*sizeof(INODE))
+			.read(_iNodeToWritable(inodes[first]), (last - first + 1)*sizeof(INODE));
+		first = last + 1;
+	}
+	return inodes;
+}
+
+// Block 0 always belongs to the root, so a zero pointer past the first one is unused
+std::vector<int> _usedBlocks(const INODE& inode, MetaData& metaData)
+{
+	std::vector<int> blocks{};
+	if(_isInline(inode)){
+		return blocks;
+	}
+	usize count = _blocksNeededToStore(static_cast<u8>(inode.SIZE), metaData.geometry);
+	if((inode.IS_DIR & INODE_FLAG_DIR) != 0){
+		count = std::max<usize>(count, 1);
+	}
+	for(usize i = 0; i < 3 /* direct blocks size */; i++){
+		// The stored length of compressed content is only known from its chunk index
+		bool used = _isCompressed(inode) ? (i == 0 or inode.DIRECT_BLOCKS[i] != 0) : i < count;
+		if(used){
+			blocks.push_back(static_cast<u8>(inode.DIRECT_BLOCKS[i]));
+		}
+	}
+	return blocks;
+}
+
+FsStat _makeStat(const INODE& inode, MetaData& metaData)
+{
+	return {
+		str(inode.NAME, strnlen(inode.NAME, sizeof(INODE::NAME))),
+		(inode.IS_DIR & INODE_FLAG_DIR) != 0,
+		static_cast<u8>(inode.SIZE),
+		_usedBlocks(inode, metaData),
+		{ _isInline(inode), _isCompressed(inode) }
+	};
+}
+
+std::vector<FsStat> listDir(std::iostream& fs, std::string_view dirPath)
+{
+	auto metaData = _fetchMetadata(fs);
+
+	auto dirStructure = _parsePath(dirPath);
+	auto dirIndex = dirStructure.name.empty() ? 0 : _findINodeIndexByName(fs, dirStructure.name, metaData);
+	auto dir = _fetchINodeByIndex(fs, dirIndex, metaData);
+	if((dir.IS_DIR & INODE_FLAG_DIR) == 0){
+		throw std::runtime_error("Path is not a directory");
+	}
+
+	// Entry order is kept in the result, the inode table is read in index order
+	auto entries = _readBlocks(fs, dir, metaData);
+	std::vector<usize> indexes{};
+	for(c8 entry : entries){
+		usize index = static_cast<u8>(entry);
+		if(index < static_cast<usize>(static_cast<u8>(metaData.numINodes))){
+			indexes.push_back(index);
+		}
+	}
+	std::sort(indexes.begin(), indexes.end());
+	indexes.erase(std::unique(indexes.begin(), indexes.end()), indexes.end());
+	auto inodes = _fetchINodesByIndex(fs, indexes, metaData);
+
+	std::vector<FsStat> stats{};
+	for(c8 entry : entries){
+		usize index = static_cast<u8>(entry);
+		auto found = std::lower_bound(indexes.begin(), indexes.end(), index);
+		if(found == indexes.end() or *found != index){
+			continue;
+		}
+		auto& inode = inodes[found - indexes.begin()];
+		if(inode.IS_USED == 1){
+			stats.push_back(_makeStat(inode, metaData));
+		}
+	}
+	return stats;
+}
+
+std::vector<FsStat> statMany(std::iostream& fs, const std::vector<std::string_view>& paths)
+{
+	auto metaData = _fetchMetadata(fs);
+
+	// Names are looked up in the whole table, which is read at once
+	std::vector<usize> all(static_cast<u8>(metaData.numINodes));
+	std::iota(all.begin(), all.end(), 0);
+	auto inodes = _fetchINodesByIndex(fs, all, metaData);
+
+	std::vector<FsStat> stats{};
+	for(auto path : paths){
+		auto name = _parsePath(path).name;
+		auto key = _makeNameKey(name.empty() ? "/" : name);
+		auto found = std::find_if(inodes.begin(), inodes.end(), [&](const INODE& inode){
+			return inode.IS_USED == 1 && _hasName(inode, key);
+		});
+		if(found == inodes.end()){
+			throw std::runtime_error("Path does not exist");
+		}
+		stats.push_back(_makeStat(*found, metaData));
+	}
+	return stats;
+}
+
+void resizeFs(std::iostream& fs, int numBlocks, int numInodes)
+{
+	auto oldMetaData = _fetchMetadata(fs);
+	auto& oldGeometry = oldMetaData.geometry;
+	if(numBlocks > 127 or numInodes > 127){
+		throw std::runtime_error("Image too big");
+	}
+	if(static_cast<usize>(numBlocks) < oldGeometry.numBlocks or static_cast<usize>(numInodes) < oldGeometry.numINodes){
+		throw std::runtime_error("Can not shrink the image");
+	}
+
+	usize oldSize = _blockOffSet(oldGeometry, oldGeometry.numBlocks);
+	str oldImage(oldSize, '\0');
+	fs.seekg(0).read(&oldImage[0], oldSize);
+
+	// Block pointers are indexes into the data region, so moving the region as a
+	// whole keeps every pointer valid and only the offsets in the geometry change
+	auto metaData = _makeMetaData(oldMetaData.blockSize, numBlocks, numInodes);
+	auto& geometry = metaData.geometry;
+	str image(_blockOffSet(geometry, geometry.numBlocks), '\0');
+	image[_getBlockSizeOffSet()] = metaData.blockSize;
+	image[_getNumBlocksOffSet()] = metaData.numBlocks;
+	image[_getNumINodesOffSet()] = metaData.numINodes;
+	auto copy = [&](usize from, usize to, usize length){
+		std::memcpy(&image[to], &oldImage[from], length);
+	};
+	copy(_getBitMapOffSet(), _getBitMapOffSet(), oldGeometry.bitMapSize);
+	copy(oldGeometry.iNodesOffSet, geometry.iNodesOffSet, oldGeometry.numINodes*sizeof(INODE));
+	copy(_getRootIndexOffSet(oldMetaData.numBlocks, oldMetaData.numINodes), _getRootIndexOffSet(metaData.numBlocks, metaData.numINodes), sizeof(c8));
+	copy(oldGeometry.blocksOffSet, geometry.blocksOffSet, oldSize - oldGeometry.blocksOffSet);
+
+	fs.seekp(0).write(image.data(), image.size());
+	fs.flush();
+}
+
+// File name entry points, they open the image and forward to the stream versions
+void addFile(std::string fsFileName, std::string filePath, std::string fileContent)
+{
+	traceRecord("addFile", {fsFileName, filePath, fileContent});
+	std::fstream fs{ fsFileName, std::ios::binary | std::ios::in | std::ios::out };
+	addFile(fs, filePath, fileContent);
+}
+
+void addFile(std::string fsFileName, std::string filePath, std::string fileContent, FileOptions options)
+{
+	// The options are traced as a fourth argument, 'i' for inlineData and 'c' for compress
+	str traceOptions = str(options.inlineData ? "i" : "") + (options.compress ? "c" : "");
+	traceRecord("addFile", {fsFileName, filePath, fileContent, traceOptions});
+	std::fstream fs{ fsFileName, std::ios::binary | std::ios::in | std::ios::out };
+	addFile(fs, filePath, fileContent, options);
+}
+
+std::string readFile(std::string fsFileName, std::string filePath)
+{
+	std::fstream fs{ fsFileName, std::ios::binary | std::ios::in };
+	return readFile(fs, filePath);
+}
+
+std::string readAt(std::string fsFileName, std::string filePath, int offset, int length)
+{
+	std::fstream fs{ fsFileName, std::ios::binary | std::ios::in };
+	return readAt(fs, filePath, offset, length);
+}
+
+void exportFs(std::string fsFileName, const std::function<void(const FsEntry&)>& visit)
+{
+	std::fstream fs{ fsFileName, std::ios::binary | std::ios::in };
+	exportFs(fs, visit);
+}
+
+void resizeFs(std::string fsFileName, int numBlocks, int numInodes)
+{
+	traceRecord("resizeFs", {fsFileName, std::to_string(numBlocks), std::to_string(numInodes)});
+	std::fstream fs{ fsFileName, std::ios::binary | std::ios::in | std::ios::out };
+	resizeFs(fs, numBlocks, numInodes);
+}
+
+std::vector<FsStat> listDir(std::string fsFileName, std::string dirPath)
+{
+	std::fstream fs{ fsFileName, std::ios::binary | std::ios::in };
+	return listDir(fs, dirPath);
+}
+
+std::vector<FsStat> statMany(std::string fsFileName, std::vector<std::string> paths)
+{
+	std::fstream fs{ fsFileName, std::ios::binary | std::ios::in };
+	return statMany(fs, std::vector<std::string_view>(paths.begin(), paths.end()));
+}
+
+void writeAt(std::string fsFileName, std::string filePath, int offset, std::string bytes)
+{
+	traceRecord("writeAt", {fsFileName, filePath, std::to_string(offset), bytes});
+	std::fstream fs{ fsFileName, std::ios::binary | std::ios::in | std::ios::out };
+	writeAt(fs, filePath, offset, bytes);
+}
+
+void append(std::string fsFileName, std::string filePath, std::string bytes)
+{
+	traceRecord("append", {fsFileName, filePath, bytes});
+	std::fstream fs{ fsFileName, std::ios::binary | std::ios::in | std::ios::out };
+	append(fs, filePath, bytes);
+}
+
+void addDir(std::string fsFileName, std::string dirPath)
+{
+	traceRecord("addDir", {fsFileName, dirPath});
+	std::fstream fs{ fsFileName, std::ios::binary | std::ios::in | std::ios::out };
+	addDir(fs, dirPath);
+}
+
+void remove(std::string fsFileName, std::string path)
+{
+	traceRecord("remove", {fsFileName, path});
+	std::fstream fs{ fsFileName, std::ios::binary | std::ios::in | std::ios::out };
+	remove(fs, path);
+}
+
+void move(std::string fsFileName, std::string oldPath, std::string newPath)
+{
+	traceRecord("move", {fsFileName, oldPath, newPath});
+	std::fstream fs{ fsFileName, std::ios::binary | std::ios::in | std::ios::out };
+	move(fs, oldPath, newPath);
+}
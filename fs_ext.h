@@ -0,0 +1,174 @@
+#ifndef fs_ext_h
+#define fs_ext_h
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Extensions to the API in fs.h, which must be kept as handed out.
+ * Everything here works on images created by initFs.
+ */
+
+/**
+ * @brief Per file options for addFile
+ */
+struct FileOptions {
+    // Store content that fits in the block pointer bytes of the INODE itself,
+    // no data block is allocated for it
+    bool inlineData = false;
+    // Compress the content with the built in LZ codec, only kept when it saves a block
+    bool compress = false;
+};
+
+/**
+ * @brief A file or directory to be written by the populating initFs
+ */
+struct FsTreeNode {
+    std::string name;
+    bool isDir = false;
+    std::string content;                // only for files
+    std::vector<FsTreeNode> children;   // only for directories
+};
+
+/**
+ * @brief Same as initFs in fs.h, but also writes a whole directory tree into the new image.
+ * The layout is planned in memory, with the children of each directory in adjacent inodes
+ * and blocks, and the image is written to disk in a single write.
+ * Since lookup is by name, every name in the tree must be unique and fit in
+ * INODE::NAME, otherwise nothing is written and an exception is thrown.
+ * @param fsFileName nome do arquivo que contém sistema de arquivos que simula EXT3
+ * @param blockSize tamanho em bytes do bloco
+ * @param numBlocks quantidade de blocos
+ * @param numInodes quantidade de inodes
+ * @param root the root directory, its name is ignored
+ */
+void initFs(std::string fsFileName, int blockSize, int numBlocks, int numInodes, const FsTreeNode& root);
+
+/**
+ * @brief A file or directory visited by exportFs
+ */
+struct FsEntry {
+    std::string path;       // relative to the root, without the leading '/'
+    bool isDir = false;
+    std::string content;    // only for files
+};
+
+/**
+ * @brief Walks the directory tree from the root inode and hands every entry to visit.
+ * Directories come first, parents before children, then files in the physical order
+ * of their first block so the data region is read sequentially. Only one file
+ * content is held in memory at a time.
+ * @param fsFileName arquivo que contém um sistema sistema de arquivos que simula EXT3.
+ * @param visit called once per entry, the root itself is not visited
+ */
+void exportFs(std::string fsFileName, const std::function<void(const FsEntry&)>& visit);
+
+/**
+ * @brief Grows an existing image in place, without reformatting it.
+ * The bitmap and the inode table are extended and the data region is moved
+ * after them in one bulk copy. Block pointers are indexes into the data
+ * region, so they stay valid. Images can not shrink.
+ * @param fsFileName arquivo que contém um sistema sistema de arquivos que simula EXT3.
+ * @param numBlocks nova quantidade de blocos, até 127
+ * @param numInodes nova quantidade de inodes, até 127
+ */
+void resizeFs(std::string fsFileName, int numBlocks, int numInodes);
+
+/**
+ * @brief What listDir and statMany report about a file or directory
+ */
+struct FsStat {
+    std::string name;
+    bool isDir = false;
+    int size = 0;               // bytes for files, entries for directories
+    std::vector<int> blocks;    // data blocks in order, empty for inline files
+    FileOptions options;        // how a file is stored, so a copy can be stored the same way
+};
+
+/**
+ * @brief Lists the entries of a directory in the order they are stored.
+ * The entry blocks are read once and the child inodes in a single pass over
+ * the inode table, adjacent records are fetched with one read.
+ * @param fsFileName arquivo que contém um sistema sistema de arquivos que simula EXT3.
+ * @param dirPath caminho completo do diretório, "/" para a raiz
+ * @return one FsStat per entry
+ */
+std::vector<FsStat> listDir(std::string fsFileName, std::string dirPath);
+
+/**
+ * @brief Stats several paths with a single read of the inode table.
+ * @param fsFileName arquivo que contém um sistema sistema de arquivos que simula EXT3.
+ * @param paths caminhos completos dos arquivos ou diretórios
+ * @return one FsStat per path, in the same order
+ */
+std::vector<FsStat> statMany(std::string fsFileName, std::vector<std::string> paths);
+
+/**
+ * @brief Same as addFile in fs.h, with per file options.
+ * @param fsFileName arquivo que contém um sistema sistema de arquivos que simula EXT3.
+ * @param filePath caminho completo novo arquivo dentro sistema de arquivos que simula EXT3.
+ * @param fileContent conteúdo do novo arquivo
+ * @param options how the content should be stored
+ */
+void addFile(std::string fsFileName, std::string filePath, std::string fileContent, FileOptions options);
+
+/**
+ * @brief Reads the whole content of a file.
+ * @param fsFileName arquivo que contém um sistema sistema de arquivos que simula EXT3.
+ * @param filePath caminho completo do arquivo.
+ * @return conteúdo do arquivo
+ */
+std::string readFile(std::string fsFileName, std::string filePath);
+
+/**
+ * @brief Reads part of a file. Compressed files only decompress the chunks covering the range.
+ * @param fsFileName arquivo que contém um sistema sistema de arquivos que simula EXT3.
+ * @param filePath caminho completo do arquivo.
+ * @param offset posição em bytes onde a leitura começa
+ * @param length quantidade de bytes, a leitura para no fim do arquivo
+ * @return conteúdo lido
+ */
+std::string readAt(std::string fsFileName, std::string filePath, int offset, int length);
+
+/**
+ * @brief Writes bytes at a position of an existing file, growing it if needed.
+ * Only the blocks covering [offset, offset + bytes.size()) are touched, new blocks
+ * are allocated for growth. Writing past the end fills the gap with zeros.
+ * @param fsFileName arquivo que contém um sistema sistema de arquivos que simula EXT3.
+ * @param filePath caminho completo do arquivo.
+ * @param offset posição em bytes onde a escrita começa
+ * @param bytes conteúdo a ser escrito
+ */
+void writeAt(std::string fsFileName, std::string filePath, int offset, std::string bytes);
+
+/**
+ * @brief Appends bytes to the end of an existing file, see writeAt.
+ * @param fsFileName arquivo que contém um sistema sistema de arquivos que simula EXT3.
+ * @param filePath caminho completo do arquivo.
+ * @param bytes conteúdo a ser adicionado
+ */
+void append(std::string fsFileName, std::string filePath, std::string bytes);
+
+/**
+ * Stream versions of the entry points, they work on an already open image instead
+ * of reopening the file on every call. The stream can be a std::fstream or an in
+ * memory copy of the whole image, such as a std::stringstream. Paths and contents
+ * are taken as views and are never copied.
+ */
+void addFile(std::iostream& fs, std::string_view filePath, std::string_view fileContent);
+void addFile(std::iostream& fs, std::string_view filePath, std::string_view fileContent, FileOptions options);
+void addDir(std::iostream& fs, std::string_view dirPath);
+void remove(std::iostream& fs, std::string_view path);
+void move(std::iostream& fs, std::string_view oldPath, std::string_view newPath);
+std::string readFile(std::iostream& fs, std::string_view filePath);
+std::string readAt(std::iostream& fs, std::string_view filePath, int offset, int length);
+void exportFs(std::iostream& fs, const std::function<void(const FsEntry&)>& visit);
+void writeAt(std::iostream& fs, std::string_view filePath, int offset, std::string_view bytes);
+void append(std::iostream& fs, std::string_view filePath, std::string_view bytes);
+void resizeFs(std::iostream& fs, int numBlocks, int numInodes);
+std::vector<FsStat> listDir(std::iostream& fs, std::string_view dirPath);
+std::vector<FsStat> statMany(std::iostream& fs, const std::vector<std::string_view>& paths);
+
+#endif /* fs_ext_h */
@@ -0,0 +1,189 @@
+#include "fsd.h"
+#include "fs_ext.h"
+#include "trace.h"
+
+#include <stdexcept>
+
+// Type Aliases
+using u8 = uint8_t;
+using u16 = uint16_t;
+using u32 = uint32_t;
+using usize = size_t;
+using str = std::string;
+
+constexpr usize FRAME_LENGTH_SIZE = sizeof(u32);
+
+void _putU16(str& out, u16 value)
+{
+	out.push_back(static_cast<char>(value & 0xFF));
+	out.push_back(static_cast<char>(value >> 8));
+}
+
+void _putU32(str& out, u32 value)
+{
+	for(usize i = 0; i < sizeof(u32); i++){
+		out.push_back(static_cast<char>((value >> (8*i)) & 0xFF));
+	}
+}
+
+u32 _getU32(const str& in, usize offset)
+{
+	u32 value = 0;
+	for(usize i = 0; i < sizeof(u32); i++){
+		value |= static_cast<u32>(static_cast<u8>(in[offset + i])) << (8*i);
+	}
+	return value;
+}
+
+u16 _getU16(const str& in, usize offset)
+{
+	return static_cast<u8>(in[offset]) | static_cast<u8>(in[offset + 1]) << 8;
+}
+
+// @returns the length of the frame starting at offset, or 0 if it is not complete
+usize _completeFrameSize(const str& input, usize offset)
+{
+	if(input.size() - offset < FRAME_LENGTH_SIZE){
+		return 0;
+	}
+	usize frameSize = FRAME_LENGTH_SIZE + _getU32(input, offset);
+	return input.size() - offset >= frameSize ? frameSize : 0;
+}
+
+str _encodeFrame(u32 id, u8 code, const str& body)
+{
+	str frame{};
+	_putU32(frame, sizeof(u32) + sizeof(u8) + body.size());
+	_putU32(frame, id);
+	frame.push_back(static_cast<char>(code));
+	frame += body;
+	return frame;
+}
+
+std::vector<str> _decodeArgs(const str& frame, usize offset)
+{
+	std::vector<str> args{};
+	while(offset < frame.size()){
+		if(offset + sizeof(u16) > frame.size()){
+			throw std::runtime_error("Malformed argument");
+		}
+		usize length = _getU16(frame, offset);
+		offset += sizeof(u16);
+		if(offset + length > frame.size()){
+			throw std::runtime_error("Malformed argument");
+		}
+		args.push_back(frame.substr(offset, length));
+		offset += length;
+	}
+	return args;
+}
+
+void _expectArgs(const std::vector<str>& args, usize count)
+{
+	if(args.size() != count){
+		throw std::runtime_error("Wrong number of arguments");
+	}
+}
+
+// @returns the payload of the response
+str _execute(std::iostream& image, u8 op, const std::vector<str>& args, bool& dirty, const str& fsFileName)
+{
+	switch(op){
+	case FSD_OP_ADD_FILE:
+		_expectArgs(args, 2);
+		dirty = true;
+		traceRecord("addFile", {fsFileName, args[0], args[1]});
+		addFile(image, args[0], args[1]);
+		return "";
+	case FSD_OP_ADD_DIR:
+		_expectArgs(args, 1);
+		dirty = true;
+		traceRecord("addDir", {fsFileName, args[0]});
+		addDir(image, args[0]);
+		return "";
+	case FSD_OP_REMOVE:
+		_expectArgs(args, 1);
+		dirty = true;
+		traceRecord("remove", {fsFileName, args[0]});
+		remove(image, args[0]);
+		return "";
+	case FSD_OP_MOVE:
+		_expectArgs(args, 2);
+		dirty = true;
+		traceRecord("move", {fsFileName, args[0], args[1]});
+		move(image, args[0], args[1]);
+		return "";
+	case FSD_OP_READ:
+		_expectArgs(args, 1);
+		return readFile(image, args[0]);
+	}
+	throw std::runtime_error("Unknown operation");
+}
+
+std::string fsdEncodeRequest(uint32_t id, FsdOp op, const std::vector<std::string>& args)
+{
+	str body{};
+	for(auto& arg : args){
+		_putU16(body, arg.size());
+		body += arg;
+	}
+	return _encodeFrame(id, op, body);
+}
+
+bool fsdDecodeResponse(std::string& input, FsdResponse& response)
+{
+	usize frameSize = _completeFrameSize(input, 0);
+	if(frameSize == 0){
+		return false;
+	}
+	response.id = _getU32(input, FRAME_LENGTH_SIZE);
+	response.status = static_cast<FsdStatus>(input[FRAME_LENGTH_SIZE + sizeof(u32)]);
+	usize payloadOffset = FRAME_LENGTH_SIZE + sizeof(u32) + sizeof(u8);
+	response.payload = input.substr(payloadOffset, frameSize - payloadOffset);
+	input.erase(0, frameSize);
+	return true;
+}
+
+bool fsdFrameTooBig(const std::string& input)
+{
+	return input.size() >= FRAME_LENGTH_SIZE and _getU32(input, 0) > FSD_MAX_FRAME_SIZE;
+}
+
+std::string fsdServe(std::iostream& image, std::string& input, bool& dirty, const std::string& fsFileName)
+{
+	str responses{};
+	usize consumed = 0;
+	usize headerSize = FRAME_LENGTH_SIZE + sizeof(u32) + sizeof(u8);
+
+	// Every complete frame is handled in one go, so a pipelined batch costs one call
+	for(;;){
+		if(fsdFrameTooBig(input.substr(consumed, FRAME_LENGTH_SIZE))){
+			responses += _encodeFrame(0, FSD_STATUS_ERROR, "Frame too big");
+			break;
+		}
+		usize frameSize = _completeFrameSize(input, consumed);
+		if(frameSize == 0){
+			break;
+		}
+		str frame = input.substr(consumed, frameSize);
+		consumed += frameSize;
+
+		if(frameSize < headerSize){
+			responses += _encodeFrame(0, FSD_STATUS_ERROR, "Malformed frame");
+			continue;
+		}
+		u32 id = _getU32(frame, FRAME_LENGTH_SIZE);
+		u8 op = frame[FRAME_LENGTH_SIZE + sizeof(u32)];
+		try {
+			auto payload = _execute(image, op, _decodeArgs(frame, headerSize), dirty, fsFileName);
+			responses += _encodeFrame(id, FSD_STATUS_OK, payload);
+		} catch(const std::exception& e) {
+			// A failed operation can leave the stream in a failed state
+			image.clear();
+			responses += _encodeFrame(id, FSD_STATUS_ERROR, e.what());
+		}
+	}
+
+	input.erase(0, consumed);
+	return responses;
+}
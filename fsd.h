@@ -0,0 +1,78 @@
+#ifndef fsd_h
+#define fsd_h
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * Binary protocol of the filesystem daemon (fsd).
+ *
+ * Every integer is little endian. A request frame is
+ *   u32 frame length (of everything after this field)
+ *   u32 request id, echoed back in the response
+ *   u8  operation, see FsdOp
+ *   arguments, each one as u16 length + bytes
+ * and a response frame is
+ *   u32 frame length
+ *   u32 request id
+ *   u8  status, see FsdStatus
+ *   payload, file content for FSD_OP_READ and the message for errors
+ *
+ * Clients may send any number of requests without waiting for the responses,
+ * they are executed and answered in the order they were sent. A frame length
+ * above FSD_MAX_FRAME_SIZE is answered with an error and the connection closed.
+ */
+
+constexpr uint32_t FSD_MAX_FRAME_SIZE = 64 * 1024;
+
+enum FsdOp : uint8_t {
+    FSD_OP_ADD_FILE = 0x01, // path, content
+    FSD_OP_ADD_DIR  = 0x02, // path
+    FSD_OP_REMOVE   = 0x03, // path
+    FSD_OP_MOVE     = 0x04, // old path, new path
+    FSD_OP_READ     = 0x05, // path
+};
+
+enum FsdStatus : uint8_t {
+    FSD_STATUS_OK    = 0x00,
+    FSD_STATUS_ERROR = 0x01,
+};
+
+struct FsdResponse {
+    uint32_t id;
+    FsdStatus status;
+    std::string payload;
+};
+
+/**
+ * @brief Encodes one request frame.
+ */
+std::string fsdEncodeRequest(uint32_t id, FsdOp op, const std::vector<std::string>& args);
+
+/**
+ * @brief Decodes one response frame from the front of input.
+ * @return false if input does not hold a whole frame yet
+ */
+bool fsdDecodeResponse(std::string& input, FsdResponse& response);
+
+/**
+ * @brief Whether the frame at the front of input announces more than FSD_MAX_FRAME_SIZE.
+ * Such a frame is never consumed by fsdServe, the connection can not be used anymore.
+ */
+bool fsdFrameTooBig(const std::string& input);
+
+/**
+ * @brief Executes every complete request frame at the front of input against the image
+ * and removes them from input. A partial frame at the end is kept for the next call,
+ * a frame that is too big is answered with an error once and left in input.
+ * @param image imagem do sistema de arquivos que simula EXT3, normalmente mantida em memória.
+ * @param input bytes received from a client
+ * @param dirty set when some request modified the image
+ * @param fsFileName the file the image is stored in, requests that change the image
+ * are traced against it (see trace.h)
+ * @return the response frames, in request order
+ */
+std::string fsdServe(std::iostream& image, std::string& input, bool& dirty, const std::string& fsFileName);
+
+#endif /* fsd_h */
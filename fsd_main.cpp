@@ -0,0 +1,224 @@
+#include "fsd.h"
+
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Type Aliases
+using usize = size_t;
+using str = std::string;
+
+volatile std::sig_atomic_t stopRequested = 0;
+
+void _onStopSignal(int) { stopRequested = 1; }
+
+// The whole image is kept in memory, so every client shares one warm copy
+std::stringstream _loadImage(const str& fsFileName)
+{
+	std::ifstream file{ fsFileName, std::ios::binary };
+	if(!file){
+		throw std::runtime_error("Could not open image");
+	}
+	std::stringstream image{ std::ios::binary | std::ios::in | std::ios::out };
+	image << file.rdbuf();
+	return image;
+}
+
+// Written to a temporary file next to the image and renamed over it, so a crash
+// or a full disk part way through leaves the previous image in place
+void _storeImage(std::stringstream& image, const str& fsFileName)
+{
+	str tempFileName = fsFileName + ".tmp";
+	auto fail = [&](const char* what){
+		str message = str("Could not store image, ") + what + ": " + std::strerror(errno);
+		unlink(tempFileName.c_str());
+		throw std::runtime_error(message);
+	};
+
+	int file = open(tempFileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(file < 0){
+		fail("open");
+	}
+	auto content = image.str();
+	usize written = 0;
+	while(written < content.size()){
+		auto n = write(file, content.data() + written, content.size() - written);
+		if(n < 0 and errno == EINTR){
+			continue;
+		}
+		if(n <= 0){
+			close(file);
+			fail("write");
+		}
+		written += n;
+	}
+	if(fsync(file) < 0){
+		close(file);
+		fail("fsync");
+	}
+	if(close(file) < 0){
+		fail("close");
+	}
+	if(rename(tempFileName.c_str(), fsFileName.c_str()) < 0){
+		fail("rename");
+	}
+}
+
+int _listen(const str& socketPath)
+{
+	sockaddr_un address{};
+	if(socketPath.size() >= sizeof(address.sun_path)){
+		throw std::runtime_error("Socket path too long");
+	}
+	address.sun_family = AF_UNIX;
+	std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(socketPath.c_str());
+	if(listener < 0
+		or bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+		or listen(listener, SOMAXCONN) < 0
+	){
+		throw std::runtime_error(std::string("Could not listen: ") + std::strerror(errno));
+	}
+	return listener;
+}
+
+void _setNonBlocking(int socket)
+{
+	if(fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK) < 0){
+		throw std::runtime_error(std::string("Could not set non blocking: ") + std::strerror(errno));
+	}
+}
+
+struct _Client {
+	str input{};
+	str output{};       // responses not accepted by the socket yet
+	bool closing = false; // close once output is sent
+};
+
+// Responses a client may leave unread before its requests stop being read
+constexpr usize MAX_PENDING_OUTPUT = 1 << 20;
+
+// @returns false if the connection is gone
+bool _sendPending(int socket, _Client& client)
+{
+	while(!client.output.empty()){
+		auto n = send(socket, client.output.data(), client.output.size(), MSG_NOSIGNAL);
+		if(n < 0 and (errno == EAGAIN or errno == EWOULDBLOCK)){
+			return true;
+		}
+		if(n <= 0){
+			return false;
+		}
+		client.output.erase(0, n);
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	if(argc != 3){
+		std::cerr << "usage: " << argv[0] << " <image> <socket>" << std::endl;
+		return 1;
+	}
+	str fsFileName{argv[1]};
+	str socketPath{argv[2]};
+
+	std::signal(SIGINT, _onStopSignal);
+	std::signal(SIGTERM, _onStopSignal);
+
+	try {
+		auto image = _loadImage(fsFileName);
+		int listener = _listen(socketPath);
+
+		_setNonBlocking(listener);
+
+		// Keyed by socket
+		std::map<int, _Client> clients{};
+		char buff[4096];
+
+		while(!stopRequested){
+			std::vector<pollfd> fds{{listener, POLLIN, 0}};
+			for(auto& [socket, client] : clients){
+				// A client that does not read its responses only stalls itself
+				short events = client.closing or client.output.size() >= MAX_PENDING_OUTPUT ? 0 : POLLIN;
+				if(!client.output.empty()){
+					events |= POLLOUT;
+				}
+				fds.push_back({socket, events, 0});
+			}
+			if(poll(fds.data(), fds.size(), -1) < 0){
+				continue; // Interrupted by a signal
+			}
+
+			if(fds[0].revents & POLLIN){
+				int socket = accept(listener, nullptr, nullptr);
+				if(socket >= 0){
+					_setNonBlocking(socket);
+					clients[socket] = {};
+				}
+			}
+
+			// One writer: requests of every client are applied one after the other,
+			// and the image is written back once per round instead of once per request
+			bool dirty = false;
+			std::vector<int> gone{};
+			for(usize i = 1; i < fds.size(); i++){
+				int socket = fds[i].fd;
+				auto& client = clients[socket];
+				if(fds[i].revents & (POLLHUP | POLLERR) and !(fds[i].revents & POLLIN)){
+					gone.push_back(socket);
+					continue;
+				}
+				if(fds[i].revents & POLLIN){
+					auto n = recv(socket, buff, sizeof(buff), 0);
+					if(n == 0 or (n < 0 and errno != EAGAIN and errno != EWOULDBLOCK)){
+						gone.push_back(socket);
+						continue;
+					}
+					if(n > 0){
+						client.input.append(buff, n);
+						client.output += fsdServe(image, client.input, dirty, fsFileName);
+						// The stream can not be resynchronized past a frame that is not read
+						if(fsdFrameTooBig(client.input)){
+							client.input.clear();
+							client.closing = true;
+						}
+					}
+				}
+				if(!_sendPending(socket, client) or (client.closing and client.output.empty())){
+					gone.push_back(socket);
+				}
+			}
+			for(int socket : gone){
+				close(socket);
+				clients.erase(socket);
+			}
+			if(dirty){
+				_storeImage(image, fsFileName);
+			}
+		}
+
+		for(auto& [socket, client] : clients){
+			close(socket);
+		}
+		close(listener);
+		unlink(socketPath.c_str());
+		_storeImage(image, fsFileName);
+	} catch(const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
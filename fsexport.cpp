@@ -0,0 +1,209 @@
+#include "fs_ext.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Type Aliases
+using usize = size_t;
+using str = std::string;
+namespace fsys = std::filesystem;
+
+constexpr usize TAR_BLOCK_SIZE = 512;
+// Files waiting for an extraction thread, bounds memory when the image is read faster than written
+constexpr usize MAX_QUEUED_FILES = 64;
+// Extraction is bound by the disk, more threads than this only add contention
+constexpr usize MAX_EXPORT_THREADS = 64;
+
+void _writeTarOctal(char* field, usize width, usize value)
+{
+	std::snprintf(field, width, "%0*zo", static_cast<int>(width - 1), value);
+}
+
+// exportFs already rejects bad names, this keeps a bad path from ever leaving outDir
+void _checkRelativePath(const str& path)
+{
+	usize start = 0;
+	while(start <= path.size()){
+		usize end = std::min(path.find('/', start), path.size());
+		str component = path.substr(start, end - start);
+		if(component.empty() or component == "." or component == ".."){
+			throw std::runtime_error("Unsafe path in image: " + path);
+		}
+		start = end + 1;
+	}
+}
+
+void _writeTarEntry(std::ostream& out, const FsEntry& entry)
+{
+	_checkRelativePath(entry.path);
+	str name = entry.isDir ? entry.path + "/" : entry.path;
+	char header[TAR_BLOCK_SIZE]{};
+	if(name.size() > 100){
+		throw std::runtime_error("Path too long for tar: " + name);
+	}
+	std::memcpy(header, name.data(), name.size());
+	_writeTarOctal(header + 100, 8, entry.isDir ? 0755 : 0644);
+	_writeTarOctal(header + 108, 8, 0);
+	_writeTarOctal(header + 116, 8, 0);
+	_writeTarOctal(header + 124, 12, entry.content.size());
+	_writeTarOctal(header + 136, 12, 0);
+	header[156] = entry.isDir ? '5' : '0';
+	std::memcpy(header + 257, "ustar", 6);
+	std::memcpy(header + 263, "00", 2);
+
+	// The checksum is computed with its own field filled with spaces
+	std::memset(header + 148, ' ', 8);
+	usize checksum = 0;
+	for(unsigned char c : header){
+		checksum += c;
+	}
+	std::snprintf(header + 148, 8, "%06zo", checksum);
+
+	out.write(header, TAR_BLOCK_SIZE);
+	out.write(entry.content.data(), entry.content.size());
+	usize padding = (TAR_BLOCK_SIZE - entry.content.size() % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+	char zeros[TAR_BLOCK_SIZE]{};
+	out.write(zeros, padding);
+}
+
+void _exportTar(const str& fsFileName, std::ostream& out)
+{
+	exportFs(fsFileName, [&](const FsEntry& entry){ _writeTarEntry(out, entry); });
+	char zeros[2*TAR_BLOCK_SIZE]{};
+	out.write(zeros, sizeof(zeros));
+	out.flush();
+}
+
+// @returns the files that could not be written
+std::vector<str> _exportDir(const str& fsFileName, const fsys::path& outDir, usize numThreads)
+{
+	std::mutex mutex{};
+	std::condition_variable changed{};
+	std::deque<FsEntry> queue{};
+	std::vector<str> failed{};
+	bool done = false;
+
+	std::vector<std::thread> workers{};
+	for(usize i = 0; i < numThreads; i++){
+		workers.emplace_back([&]{
+			for(;;){
+				std::unique_lock<std::mutex> lock{mutex};
+				changed.wait(lock, [&]{ return done or !queue.empty(); });
+				if(queue.empty()){
+					return;
+				}
+				auto entry = std::move(queue.front());
+				queue.pop_front();
+				changed.notify_all();
+				lock.unlock();
+
+				std::ofstream file{ outDir / entry.path, std::ios::binary | std::ios::trunc };
+				file.write(entry.content.data(), entry.content.size());
+				file.close();
+				if(!file){
+					lock.lock();
+					failed.push_back(entry.path);
+				}
+			}
+		});
+	}
+
+	auto joinWorkers = [&]{
+		{
+			std::lock_guard<std::mutex> lock{mutex};
+			done = true;
+		}
+		changed.notify_all();
+		for(auto& worker : workers){
+			worker.join();
+		}
+	};
+
+	try {
+		fsys::create_directories(outDir);
+		// Directories are visited before any file, so they exist when the workers need them
+		exportFs(fsFileName, [&](const FsEntry& entry){
+			_checkRelativePath(entry.path);
+			if(entry.isDir){
+				fsys::create_directories(outDir / entry.path);
+				return;
+			}
+			std::unique_lock<std::mutex> lock{mutex};
+			changed.wait(lock, [&]{ return queue.size() < MAX_QUEUED_FILES; });
+			queue.push_back(entry);
+			changed.notify_all();
+		});
+	} catch(...) {
+		// Files already queued are still written, the error is reported after
+		joinWorkers();
+		throw;
+	}
+	joinWorkers();
+	return failed;
+}
+
+// @returns 0 if value is not a whole number of at least 1, larger counts are capped
+usize _parseThreadCount(const str& value)
+{
+	usize digits = 0;
+	long count = 0;
+	try {
+		count = std::stol(value, &digits);
+	} catch(const std::exception&) {
+		return 0;
+	}
+	if(digits != value.size() or count < 1){
+		return 0;
+	}
+	return std::min<usize>(count, MAX_EXPORT_THREADS);
+}
+
+int main(int argc, char **argv)
+{
+	usize numThreads = std::min<usize>(std::max(1u, std::thread::hardware_concurrency()), MAX_EXPORT_THREADS);
+	if(argc == 5 and str(argv[2]) == "--dir"){
+		numThreads = _parseThreadCount(argv[4]);
+	}
+	bool usage = argc < 4 or (str(argv[2]) != "--tar" and str(argv[2]) != "--dir")
+		or (str(argv[2]) == "--tar" and argc != 4) or argc > 5 or numThreads == 0;
+	if(usage){
+		std::cerr << "usage: " << argv[0] << " <image> --tar <out.tar|-> " << std::endl
+			<< "       " << argv[0] << " <image> --dir <outDir> [numThreads, 1 to " << MAX_EXPORT_THREADS << "]" << std::endl;
+		return 1;
+	}
+
+	try {
+		str fsFileName{argv[1]};
+		str target{argv[3]};
+		if(str(argv[2]) == "--tar"){
+			if(target == "-"){
+				_exportTar(fsFileName, std::cout);
+			} else {
+				std::ofstream out{ target, std::ios::binary | std::ios::trunc };
+				_exportTar(fsFileName, out);
+			}
+		} else {
+			auto failed = _exportDir(fsFileName, target, numThreads);
+			for(auto& path : failed){
+				std::cerr << "Could not write " << path << std::endl;
+			}
+			if(!failed.empty()){
+				return 1;
+			}
+		}
+	} catch(const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
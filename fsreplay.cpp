@@ -0,0 +1,231 @@
+#include "fs.h"
+#include "fs_ext.h"
+#include "sha256.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Type Aliases
+using u64 = uint64_t;
+using usize = size_t;
+using str = std::string;
+using Clock = std::chrono::steady_clock;
+
+struct ReplayOptions {
+	str tracePath;
+	std::vector<str> fsFileNames;
+	bool paced = false;
+	std::vector<str> expectedSha256;	// in the order of fsFileNames
+};
+
+// Recorded images are mapped to the replay images in the order they first appear
+std::map<str, str> _mapImages(const std::vector<TraceOp>& ops, const std::vector<str>& fsFileNames)
+{
+	std::map<str, str> images{};
+	for(auto& op : ops){
+		if(op.args.empty()){
+			throw std::runtime_error("Operation without an image: " + op.op);
+		}
+		if(images.count(op.args[0]) == 0){
+			if(images.size() == fsFileNames.size()){
+				throw std::runtime_error("Trace touches more images than were given, first extra one is " + op.args[0]);
+			}
+			images[op.args[0]] = fsFileNames[images.size()];
+		}
+	}
+	return images;
+}
+
+// Rebuilds one entry of a traced tree, its parent directory was inserted before it
+void _insertTreeNode(FsTreeNode& root, const str& path, const str& content)
+{
+	bool isDir = !path.empty() and path.back() == '/';
+	str relative = isDir ? path.substr(0, path.size() - 1) : path;
+	FsTreeNode* dir = &root;
+	usize start = 0;
+	for(usize slash = relative.find('/'); slash != str::npos; slash = relative.find('/', start)){
+		str name = relative.substr(start, slash - start);
+		auto parent = std::find_if(dir->children.begin(), dir->children.end(), [&](const FsTreeNode& child){
+			return child.isDir and child.name == name;
+		});
+		if(parent == dir->children.end()){
+			throw std::runtime_error("Tree entry before its directory: " + path);
+		}
+		dir = &*parent;
+		start = slash + 1;
+	}
+	dir->children.push_back({relative.substr(start), isDir, content, {}});
+}
+
+// fsFileName is the replay image mapped to the one the operation was recorded on
+void _replayOp(const TraceOp& op, const str& fsFileName)
+{
+	auto& args = op.args;
+	auto expect = [&](usize count){
+		if(args.size() != count){
+			throw std::runtime_error("Wrong number of arguments for " + op.op);
+		}
+	};
+
+	if(op.op == "initFs" and args.size() > 4){
+		if(args.size() % 2 != 0){
+			throw std::runtime_error("Wrong number of arguments for " + op.op);
+		}
+		FsTreeNode root{};
+		root.isDir = true;
+		for(usize i = 4; i < args.size(); i += 2){
+			_insertTreeNode(root, args[i], args[i + 1]);
+		}
+		initFs(fsFileName, std::stoi(args[1]), std::stoi(args[2]), std::stoi(args[3]), root);
+	} else if(op.op == "initFs"){
+		expect(4);
+		initFs(fsFileName, std::stoi(args[1]), std::stoi(args[2]), std::stoi(args[3]));
+	} else if(op.op == "addFile" and args.size() == 4){
+		FileOptions options{};
+		options.inlineData = args[3].find('i') != str::npos;
+		options.compress = args[3].find('c') != str::npos;
+		addFile(fsFileName, args[1], args[2], options);
+	} else if(op.op == "addFile"){
+		expect(3);
+		addFile(fsFileName, args[1], args[2]);
+	} else if(op.op == "addDir"){
+		expect(2);
+		addDir(fsFileName, args[1]);
+	} else if(op.op == "remove"){
+		expect(2);
+		remove(fsFileName, args[1]);
+	} else if(op.op == "move"){
+		expect(3);
+		move(fsFileName, args[1], args[2]);
+	} else if(op.op == "writeAt"){
+		expect(4);
+		writeAt(fsFileName, args[1], std::stoi(args[2]), args[3]);
+	} else if(op.op == "append"){
+		expect(3);
+		append(fsFileName, args[1], args[2]);
+	} else if(op.op == "resizeFs"){
+		expect(3);
+		resizeFs(fsFileName, std::stoi(args[1]), std::stoi(args[2]));
+	} else {
+		throw std::runtime_error("Unknown operation " + op.op);
+	}
+}
+
+double _percentile(std::vector<double>& sorted, double p)
+{
+	usize index = std::min(sorted.size() - 1, static_cast<usize>(p * sorted.size()));
+	return sorted[index];
+}
+
+int main(int argc, char **argv)
+{
+	ReplayOptions options{};
+	for(int i = 1; i < argc; i++){
+		str arg{argv[i]};
+		if(arg == "--paced"){
+			options.paced = true;
+		} else if(arg == "--expect-sha256" and i + 1 < argc){
+			options.expectedSha256.push_back(argv[++i]);
+		} else if(options.tracePath.empty()){
+			options.tracePath = arg;
+		} else {
+			options.fsFileNames.push_back(arg);
+		}
+	}
+	bool usage = options.tracePath.empty() or options.fsFileNames.empty()
+		or options.expectedSha256.size() > options.fsFileNames.size();
+	if(usage){
+		std::cerr << "usage: " << argv[0] << " <trace> <image> [<image> ...] [--paced] [--expect-sha256 <hash>]..." << std::endl;
+		return 1;
+	}
+
+	std::ifstream trace{ options.tracePath, std::ios::binary };
+	if(!trace){
+		std::cerr << "Could not open trace" << std::endl;
+		return 1;
+	}
+	std::vector<TraceOp> ops{};
+	str line{};
+	for(usize lineNumber = 1; std::getline(trace, line); lineNumber++){
+		TraceOp op{};
+		if(line.empty()){
+			continue;
+		}
+		if(!traceParse(line, op)){
+			std::cerr << "Malformed trace line " << lineNumber << std::endl;
+			return 1;
+		}
+		ops.push_back(op);
+	}
+
+	std::map<str, str> images{};
+	try {
+		images = _mapImages(ops, options.fsFileNames);
+	} catch(const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	std::map<str, std::vector<double>> latenciesUs{};
+	usize failures = 0;
+	auto start = Clock::now();
+	for(auto& op : ops){
+		if(options.paced){
+			// Keeps the recorded gaps between calls
+			// Timestamps come from the wall clock, a step back is not waited for
+			u64 first = ops.front().timestampUs;
+			auto due = start + std::chrono::microseconds(op.timestampUs > first ? op.timestampUs - first : 0);
+			std::this_thread::sleep_until(due);
+		}
+
+		auto opStart = Clock::now();
+		try {
+			_replayOp(op, images[op.args[0]]);
+		} catch(const std::exception& e) {
+			failures++;
+			std::cerr << op.op << " failed: " << e.what() << std::endl;
+		}
+		auto elapsed = std::chrono::duration<double, std::micro>(Clock::now() - opStart).count();
+		latenciesUs[op.op].push_back(elapsed);
+	}
+	double totalSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::cout << std::fixed << std::setprecision(1)
+		<< ops.size() << " ops in " << totalSeconds * 1000.0 << " ms, "
+		<< (totalSeconds > 0 ? ops.size() / totalSeconds : 0.0) << " ops/s, "
+		<< failures << " failed" << std::endl;
+	std::cout << std::left << std::setw(10) << "op" << std::right
+		<< std::setw(8) << "count" << std::setw(10) << "p50 us" << std::setw(10) << "p90 us"
+		<< std::setw(10) << "p99 us" << std::setw(10) << "max us" << std::endl;
+	for(auto& [name, latencies] : latenciesUs){
+		std::sort(latencies.begin(), latencies.end());
+		std::cout << std::left << std::setw(10) << name << std::right
+			<< std::setw(8) << latencies.size()
+			<< std::setw(10) << _percentile(latencies, 0.50)
+			<< std::setw(10) << _percentile(latencies, 0.90)
+			<< std::setw(10) << _percentile(latencies, 0.99)
+			<< std::setw(10) << latencies.back() << std::endl;
+	}
+
+	bool matches = true;
+	for(usize i = 0; i < options.fsFileNames.size(); i++){
+		auto sha256 = printSha256(options.fsFileNames[i].c_str());
+		std::cout << "sha256 " << options.fsFileNames[i] << " " << sha256 << std::endl;
+		if(i < options.expectedSha256.size() and options.expectedSha256[i] != sha256){
+			std::cerr << "Image hash of " << options.fsFileNames[i] << " does not match, expected " << options.expectedSha256[i] << std::endl;
+			matches = false;
+		}
+	}
+	if(!matches){
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,109 @@
+#include "lz.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+
+// Type Aliases
+using u8 = uint8_t;
+using usize = size_t;
+using str = std::string;
+using strv = std::string_view;
+
+constexpr usize LZ_MAX_LITERAL_RUN = 0x80;
+constexpr usize LZ_MIN_MATCH = 3;
+constexpr usize LZ_MAX_MATCH = 0x7F + LZ_MIN_MATCH;
+constexpr usize LZ_MAX_DISTANCE = 0xFF;
+constexpr u8 LZ_MATCH_TAG = 0x80;
+
+usize _hash3(strv input, usize position)
+{
+	return (static_cast<u8>(input[position]) * 33u
+		^ static_cast<u8>(input[position + 1]) * 7u
+		^ static_cast<u8>(input[position + 2])) & 0xFF;
+}
+
+void _flushLiterals(str& out, strv input, usize from, usize to)
+{
+	while(from < to){
+		usize run = std::min(to - from, LZ_MAX_LITERAL_RUN);
+		out.push_back(static_cast<char>(run - 1));
+		out.append(input.substr(from, run));
+		from += run;
+	}
+}
+
+std::string lzCompress(std::string_view input)
+{
+	str out{};
+	// Last position seen for each hash of three bytes
+	std::array<long, 256> lastSeen{};
+	lastSeen.fill(-1);
+
+	usize literalsFrom = 0;
+	usize i = 0;
+	while(i + LZ_MIN_MATCH <= input.size()){
+		auto hash = _hash3(input, i);
+		long candidate = lastSeen[hash];
+		lastSeen[hash] = i;
+
+		if(candidate < 0
+			or i - candidate > LZ_MAX_DISTANCE
+			or input.compare(candidate, LZ_MIN_MATCH, input.substr(i, LZ_MIN_MATCH)) != 0
+		){
+			i++;
+			continue;
+		}
+
+		usize length = LZ_MIN_MATCH;
+		while(i + length < input.size() and length < LZ_MAX_MATCH and input[candidate + length] == input[i + length]){
+			length++;
+		}
+		_flushLiterals(out, input, literalsFrom, i);
+		out.push_back(static_cast<char>(LZ_MATCH_TAG | (length - LZ_MIN_MATCH)));
+		out.push_back(static_cast<char>(i - candidate));
+		i += length;
+		literalsFrom = i;
+	}
+	_flushLiterals(out, input, literalsFrom, input.size());
+	return out;
+}
+
+std::string lzDecompress(std::string_view input, size_t rawSize)
+{
+	str out{};
+	out.reserve(rawSize);
+
+	usize i = 0;
+	while(i < input.size()){
+		u8 tag = input[i++];
+		if(tag < LZ_MATCH_TAG){
+			usize run = tag + 1;
+			if(i + run > input.size()){
+				throw std::runtime_error("Corrupted compressed data");
+			}
+			out.append(input.substr(i, run));
+			i += run;
+			continue;
+		}
+
+		if(i >= input.size()){
+			throw std::runtime_error("Corrupted compressed data");
+		}
+		usize length = (tag & ~LZ_MATCH_TAG) + LZ_MIN_MATCH;
+		usize distance = static_cast<u8>(input[i++]);
+		if(distance == 0 or distance > out.size()){
+			throw std::runtime_error("Corrupted compressed data");
+		}
+		// Byte by byte, a match may overlap the bytes it produces
+		for(usize j = 0; j < length; j++){
+			out.push_back(out[out.size() - distance]);
+		}
+	}
+
+	if(out.size() != rawSize){
+		throw std::runtime_error("Corrupted compressed data");
+	}
+	return out;
+}
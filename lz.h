@@ -0,0 +1,27 @@
+#ifndef lz_h
+#define lz_h
+#include <string>
+#include <string_view>
+
+/**
+ * Small LZ77 codec used for compressed files.
+ *
+ * The output is a sequence of tokens:
+ *   0x00-0x7F  literal run, followed by (tag + 1) raw bytes
+ *   0x80-0xFF  match of (tag - 0x80 + 3) bytes, followed by one byte with the
+ *              distance (1-255) back into the already decoded output
+ */
+
+/**
+ * @brief Compresses input, matches only reach back 255 bytes.
+ */
+std::string lzCompress(std::string_view input);
+
+/**
+ * @brief Decompresses the output of lzCompress.
+ * @param input compressed bytes
+ * @param rawSize size of the original input
+ */
+std::string lzDecompress(std::string_view input, size_t rawSize);
+
+#endif /* lz_h */
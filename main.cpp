@@ -1,8 +1,15 @@
 #include "gtest/gtest.h"
 #include "fs.h"
+#include "fs_ext.h"
+#include "fsd.h"
+#include "shard.h"
+#include "lz.h"
+#include "trace.h"
 #include "sha256.h"
 
+#include <algorithm>
 #include <fstream>
+#include <sstream>
 #include <stdio.h>
 
 void duplicate(std::string fsrc, std::string fdest)
@@ -94,6 +101,359 @@ TEST(FsTest, case12){
     ASSERT_EQ(printSha256("fs-case12.solucao"),std::string("BC:2B:05:C8:8B:DF:02:41:3B:E3:86:8E:4C:CC:C1:FF:63:87:F9:A5:24:15:16:49:83:88:F0:75:18:D1:1B:BE"));
 }
 
+char readByte(std::string fsFileName, size_t offset)
+{
+    std::ifstream fs(fsFileName, std::ios::binary);
+    char byte{};
+    fs.seekg(offset).read(&byte, 1);
+    return byte;
+}
+
+TEST(FsTest, inlineAddFile){
+    duplicate("fs-case4.bin", "fs-inline.bin.solucao");
+
+    char bitMapBefore = readByte("fs-inline.bin.solucao", 3);
+    addFile("fs-inline.bin.solucao", "/teste.txt", "abc", FileOptions{true});
+    ASSERT_EQ(readByte("fs-inline.bin.solucao", 3), bitMapBefore);
+    ASSERT_EQ(readFile("fs-inline.bin.solucao", "/teste.txt"), std::string("abc"));
+
+    remove("fs-inline.bin.solucao", "/teste.txt");
+    ASSERT_EQ(readByte("fs-inline.bin.solucao", 3), bitMapBefore);
+}
+
+TEST(FsTest, addFileTooBig){
+    initFs("fs-too-big.bin.solucao", 4, 32, 4);
+    char bitMapBefore = readByte("fs-too-big.bin.solucao", 3);
+
+    ASSERT_THROW(addFile("fs-too-big.bin.solucao", "/big.txt", std::string(13, 'x')), std::runtime_error);
+    ASSERT_EQ(readByte("fs-too-big.bin.solucao", 3), bitMapBefore);
+    ASSERT_THROW(readFile("fs-too-big.bin.solucao", "/big.txt"), std::runtime_error);
+
+    addFile("fs-too-big.bin.solucao", "/max.txt", std::string(12, 'x'));
+    ASSERT_EQ(readFile("fs-too-big.bin.solucao", "/max.txt"), std::string(12, 'x'));
+
+    // SIZE is a single byte, even when the blocks could hold more
+    initFs("fs-too-big.bin.solucao", 100, 8, 4);
+    ASSERT_THROW(addFile("fs-too-big.bin.solucao", "/big.txt", std::string(256, 'x')), std::runtime_error);
+}
+
+TEST(FsTest, readFile){
+    ASSERT_EQ(readFile("fs-case7.bin", "/dec7556/t2.txt"), std::string("fghi"));
+}
+
+TEST(FsTest, writeAtAndAppend){
+    initFs("fs-write.bin.solucao", 2, 8, 4);
+    addFile("fs-write.bin.solucao", "/a.txt", "abc");
+
+    writeAt("fs-write.bin.solucao", "/a.txt", 1, "XY");
+    ASSERT_EQ(readFile("fs-write.bin.solucao", "/a.txt"), std::string("aXY"));
+
+    append("fs-write.bin.solucao", "/a.txt", "de");
+    ASSERT_EQ(readFile("fs-write.bin.solucao", "/a.txt"), std::string("aXYde"));
+
+    ASSERT_THROW(append("fs-write.bin.solucao", "/a.txt", "fg"), std::runtime_error);
+}
+
+TEST(FsTest, appendSpillsInline){
+    initFs("fs-write-inline.bin.solucao", 4, 8, 4);
+    addFile("fs-write-inline.bin.solucao", "/a.txt", "abc", FileOptions{true});
+
+    append("fs-write-inline.bin.solucao", "/a.txt", "defghij");
+    ASSERT_EQ(readFile("fs-write-inline.bin.solucao", "/a.txt"), std::string("abcdefghij"));
+}
+
+TEST(FsTest, fsdPipelined){
+    std::ifstream file("fs-case5.bin", std::ios::binary);
+    std::stringstream image(std::ios::binary | std::ios::in | std::ios::out);
+    image << file.rdbuf();
+
+    std::string input = fsdEncodeRequest(1, FSD_OP_ADD_DIR, {"/dec7556"})
+        + fsdEncodeRequest(2, FSD_OP_ADD_FILE, {"/dec7556/t2.txt", "fghi"})
+        + fsdEncodeRequest(3, FSD_OP_READ, {"/dec7556/t2.txt"})
+        + fsdEncodeRequest(4, FSD_OP_READ, {"/missing"});
+    // The last frame is split, as it would be across two reads from the socket
+    std::string tail = input.substr(input.size() - 3);
+    input.erase(input.size() - 3);
+
+    bool dirty = false;
+    std::string output = fsdServe(image, input, dirty, "fs-fsd.bin.solucao");
+    ASSERT_TRUE(dirty);
+    input += tail;
+    output += fsdServe(image, input, dirty, "fs-fsd.bin.solucao");
+    ASSERT_TRUE(input.empty());
+
+    FsdResponse response;
+    for(uint32_t id = 1; id <= 4; id++){
+        ASSERT_TRUE(fsdDecodeResponse(output, response));
+        ASSERT_EQ(response.id, id);
+    }
+    ASSERT_EQ(response.status, FSD_STATUS_ERROR);
+    ASSERT_FALSE(fsdDecodeResponse(output, response));
+
+    std::ofstream("fs-fsd.bin.solucao", std::ios::binary) << image.str();
+    ASSERT_EQ(readFile("fs-fsd.bin.solucao", "/dec7556/t2.txt"), std::string("fghi"));
+
+    // Content past the direct blocks is refused with an error frame, not written
+    input = fsdEncodeRequest(6, FSD_OP_ADD_FILE, {"/big.txt", std::string(100, 'x')});
+    output = fsdServe(image, input, dirty, "fs-fsd.bin.solucao");
+    ASSERT_TRUE(fsdDecodeResponse(output, response));
+    ASSERT_EQ(response.id, 6u);
+    ASSERT_EQ(response.status, FSD_STATUS_ERROR);
+
+    // A length above the limit is refused before its body is buffered
+    input = fsdEncodeRequest(5, FSD_OP_READ, {"/dec7556/t2.txt"}) + std::string("\xF0\xFF\xFF\xFF", 4);
+    output = fsdServe(image, input, dirty, "fs-fsd.bin.solucao");
+    ASSERT_TRUE(fsdFrameTooBig(input));
+    ASSERT_TRUE(fsdDecodeResponse(output, response));
+    ASSERT_EQ(response.status, FSD_STATUS_OK);
+    ASSERT_TRUE(fsdDecodeResponse(output, response));
+    ASSERT_EQ(response.payload, std::string("Frame too big"));
+}
+
+TEST(FsTest, initFsPopulate){
+    FsTreeNode dir{"dec7556", true, "", {{"t2.txt", false, "fghi", {}}}};
+    FsTreeNode root{"", true, "", {{"teste.txt", false, "abc", {}}, dir, {"e", true, "", {}}}};
+    initFs("fs-populate.bin.solucao", 2, 10, 6, root);
+
+    ASSERT_EQ(readFile("fs-populate.bin.solucao", "/teste.txt"), std::string("abc"));
+    ASSERT_EQ(readFile("fs-populate.bin.solucao", "/dec7556/t2.txt"), std::string("fghi"));
+
+    // The bitmap must account for every planned block
+    addFile("fs-populate.bin.solucao", "/e/u.txt", "xy");
+    ASSERT_EQ(readFile("fs-populate.bin.solucao", "/dec7556/t2.txt"), std::string("fghi"));
+    ASSERT_EQ(readFile("fs-populate.bin.solucao", "/e/u.txt"), std::string("xy"));
+
+    FsTreeNode longNames{"", true, "", {{"longfilename1", false, "a", {}}, {"longfilename2", false, "b", {}}}};
+    ASSERT_THROW(initFs("fs-populate.bin.solucao", 2, 10, 6, longNames), std::runtime_error);
+    FsTreeNode sameNames{"", true, "", {{"a", false, "a", {}}, {"d", true, "", {{"a", false, "b", {}}}}}};
+    ASSERT_THROW(initFs("fs-populate.bin.solucao", 2, 10, 6, sameNames), std::runtime_error);
+    ASSERT_EQ(readFile("fs-populate.bin.solucao", "/e/u.txt"), std::string("xy"));
+}
+
+TEST(FsTest, exportFs){
+    std::vector<FsEntry> entries;
+    exportFs("fs-case7.bin", [&](const FsEntry& entry){ entries.push_back(entry); });
+
+    ASSERT_EQ(entries.size(), 3u);
+    ASSERT_EQ(entries[0].path, std::string("dec7556"));
+    ASSERT_TRUE(entries[0].isDir);
+    ASSERT_EQ(entries[1].path, std::string("teste.txt"));
+    ASSERT_EQ(entries[1].content, std::string("abc"));
+    ASSERT_EQ(entries[2].path, std::string("dec7556/t2.txt"));
+    ASSERT_EQ(entries[2].content, std::string("fghi"));
+
+    // Names that would leave the export directory
+    initFs("fs-export.bin.solucao", 4, 16, 6);
+    addDir("fs-export.bin.solucao", "/..");
+    addFile("fs-export.bin.solucao", "/../evil", "x");
+    ASSERT_THROW(exportFs("fs-export.bin.solucao", [](const FsEntry&){}), std::runtime_error);
+}
+
+TEST(FsTest, nonPowerOfTwoBlockSize){
+    initFs("fs-geometry.bin.solucao", 3, 8, 4);
+    addFile("fs-geometry.bin.solucao", "/a.txt", "abcdefg");
+    ASSERT_EQ(readFile("fs-geometry.bin.solucao", "/a.txt"), std::string("abcdefg"));
+
+    writeAt("fs-geometry.bin.solucao", "/a.txt", 2, "XYZW");
+    ASSERT_EQ(readFile("fs-geometry.bin.solucao", "/a.txt"), std::string("abXYZWg"));
+}
+
+TEST(FsTest, moveToShorterName){
+    duplicate("fs-case5.bin", "fs-rename.bin.solucao");
+
+    move("fs-rename.bin.solucao", "/teste.txt", "/t.txt");
+    ASSERT_EQ(readFile("fs-rename.bin.solucao", "/t.txt"), std::string("abc"));
+    ASSERT_THROW(readFile("fs-rename.bin.solucao", "/teste.txt"), std::runtime_error);
+}
+
+TEST(FsTest, listDirAndStatMany){
+    initFs("fs-list.bin.solucao", 4, 16, 8);
+    addDir("fs-list.bin.solucao", "/d");
+    addFile("fs-list.bin.solucao", "/d/a", "abcdef");
+    addFile("fs-list.bin.solucao", "/d/b", "hi", FileOptions{true, false});
+    for(auto name : {"c", "e", "f"}){
+        addFile("fs-list.bin.solucao", std::string("/d/") + name, "");
+    }
+    addDir("fs-list.bin.solucao", "/d/g");
+
+    auto entries = listDir("fs-list.bin.solucao", "/d");
+    ASSERT_EQ(entries.size(), 6u);
+    std::vector<std::string> names;
+    for(auto& entry : entries){
+        names.push_back(entry.name);
+    }
+    ASSERT_EQ(names, (std::vector<std::string>{"a", "b", "c", "e", "f", "g"}));
+    ASSERT_EQ(entries[0].size, 6);
+    ASSERT_EQ(entries[0].blocks.size(), 2u);
+    ASSERT_TRUE(entries[1].blocks.empty());
+    ASSERT_TRUE(entries[5].isDir);
+
+    auto root = listDir("fs-list.bin.solucao", "/");
+    ASSERT_EQ(root.size(), 1u);
+    ASSERT_EQ(root[0].name, std::string("d"));
+    ASSERT_EQ(root[0].size, 6);
+
+    auto stats = statMany("fs-list.bin.solucao", {"/d/g", "/d/a", "/"});
+    ASSERT_EQ(stats[0].name, std::string("g"));
+    ASSERT_EQ(stats[1].blocks, entries[0].blocks);
+    ASSERT_EQ(stats[2].blocks, std::vector<int>{0});
+    ASSERT_THROW(listDir("fs-list.bin.solucao", "/d/a"), std::runtime_error);
+    ASSERT_THROW(statMany("fs-list.bin.solucao", {"/nope"}), std::runtime_error);
+}
+
+TEST(FsTest, directoryFull){
+    initFs("fs-dirfull.bin.solucao", 1, 16, 8);
+    addDir("fs-dirfull.bin.solucao", "/d");
+    for(auto name : {"/d/a", "/d/b", "/d/c"}){
+        addFile("fs-dirfull.bin.solucao", name, "x");
+    }
+    ASSERT_THROW(addFile("fs-dirfull.bin.solucao", "/d/e", "y"), std::runtime_error);
+    ASSERT_THROW(addDir("fs-dirfull.bin.solucao", "/d/f"), std::runtime_error);
+    addFile("fs-dirfull.bin.solucao", "/g", "z");
+    ASSERT_THROW(move("fs-dirfull.bin.solucao", "/g", "/d/g"), std::runtime_error);
+
+    ASSERT_EQ(listDir("fs-dirfull.bin.solucao", "/d").size(), 3u);
+    ASSERT_THROW(readFile("fs-dirfull.bin.solucao", "/d/e"), std::runtime_error);
+    ASSERT_EQ(readFile("fs-dirfull.bin.solucao", "/g"), std::string("z"));
+}
+
+TEST(FsTest, resizeFs){
+    initFs("fs-resize.bin.solucao", 4, 4, 3);
+    addFile("fs-resize.bin.solucao", "/a.txt", "abcdefgh");
+    ASSERT_THROW(addFile("fs-resize.bin.solucao", "/b.txt", "ijklm"), std::runtime_error);
+
+    resizeFs("fs-resize.bin.solucao", 12, 6);
+    ASSERT_EQ(readByte("fs-resize.bin.solucao", 1), 12);
+    ASSERT_EQ(readByte("fs-resize.bin.solucao", 2), 6);
+    ASSERT_EQ(readFile("fs-resize.bin.solucao", "/a.txt"), std::string("abcdefgh"));
+
+    addDir("fs-resize.bin.solucao", "/d");
+    addFile("fs-resize.bin.solucao", "/d/b.txt", "ijklm");
+    ASSERT_EQ(readFile("fs-resize.bin.solucao", "/d/b.txt"), std::string("ijklm"));
+    ASSERT_THROW(resizeFs("fs-resize.bin.solucao", 8, 6), std::runtime_error);
+}
+
+TEST(FsTest, shardedNamespace){
+    ShardMap map{{"fs-shard0.bin.solucao", "fs-shard1.bin.solucao"}, {{"a", 0}, {"b", 1}}};
+    for(auto& image : map.images){
+        initFs(image, 4, 16, 6);
+    }
+    ASSERT_EQ(shardOf(map, "/a/x.txt"), 0u);
+    ASSERT_EQ(shardOf(map, "/b"), 1u);
+    ASSERT_EQ(shardOf(map, "/other/x.txt"), shardOf(map, "/other"));
+    ASSERT_LT(shardOf(map, "/other"), 2u);
+
+    {
+        ShardedFs fs{map};
+        auto dirA = fs.addDir("/a");
+        auto dirB = fs.addDir("/b");
+        dirA.get();
+        dirB.get();
+        fs.addFile("/a/x.txt", "abcdef").get();
+        fs.move("/a/x.txt", "/b/y.txt").get();
+        ASSERT_EQ(fs.readFile("/b/y.txt").get(), std::string("abcdef"));
+        ASSERT_THROW(fs.readFile("/a/x.txt").get(), std::runtime_error);
+        ASSERT_EQ(fs.listDir("/").get().size(), 2u);
+        ASSERT_EQ(fs.listDir("/a").get().size(), 0u);
+        ASSERT_THROW(fs.addFile("/a/big.txt", std::string(100, 'x')).get(), std::runtime_error);
+
+        // Cross shard moves keep how the file is stored
+        fs.addFile("/a/in.txt", "hi", FileOptions{true, false}).get();
+        fs.move("/a/in.txt", "/b/in2.txt").get();
+        auto moved = fs.listDir("/b").get();
+        ASSERT_EQ(moved.back().name, std::string("in2.txt"));
+        ASSERT_TRUE(moved.back().options.inlineData);
+        ASSERT_TRUE(moved.back().blocks.empty());
+        ASSERT_EQ(fs.readFile("/b/in2.txt").get(), std::string("hi"));
+    }
+    ASSERT_EQ(readFile("fs-shard1.bin.solucao", "/b/y.txt"), std::string("abcdef"));
+
+    ASSERT_THROW(ShardedFs(ShardMap{}), std::runtime_error);
+    ASSERT_THROW(ShardedFs(ShardMap{map.images, {{"c", 2}}}), std::runtime_error);
+}
+
+TEST(FsTest, lzRoundTrip){
+    std::string text = "abcabcabcabcabcabc hello hello hello, aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
+    std::string compressed = lzCompress(text);
+    ASSERT_LT(compressed.size(), text.size());
+    ASSERT_EQ(lzDecompress(compressed, text.size()), text);
+    ASSERT_EQ(lzDecompress(lzCompress(""), 0), std::string(""));
+}
+
+TEST(FsTest, compressedFile){
+    initFs("fs-lz.bin.solucao", 16, 16, 4);
+    std::string text;
+    for(int i = 0; i < 12; i++){
+        text += "line " + std::to_string(i % 3) + "\n";
+    }
+
+    addFile("fs-lz.bin.solucao", "/log.txt", text, FileOptions{false, true});
+    ASSERT_EQ(readFile("fs-lz.bin.solucao", "/log.txt"), text);
+    ASSERT_EQ(readAt("fs-lz.bin.solucao", "/log.txt", 66, 10), text.substr(66, 10));
+
+    append("fs-lz.bin.solucao", "/log.txt", "end");
+    ASSERT_EQ(readFile("fs-lz.bin.solucao", "/log.txt"), text + "end");
+
+    // A rewrite that can not get its new blocks keeps the old content
+    initFs("fs-lz-full.bin.solucao", 16, 8, 8);
+    std::string small = text.substr(0, 50);
+    addFile("fs-lz-full.bin.solucao", "/log.txt", small, FileOptions{false, true});
+    // Fill every free block
+    for(auto name : {"/a", "/b", "/c", "/d", "/e", "/f"}){
+        try {
+            addFile("fs-lz-full.bin.solucao", name, std::string(16, 'z'));
+        } catch(const std::runtime_error&) {
+            break;
+        }
+    }
+    char bitMapBefore = readByte("fs-lz-full.bin.solucao", 3);
+    ASSERT_THROW(append("fs-lz-full.bin.solucao", "/log.txt", "0123456789#"), std::runtime_error);
+    ASSERT_EQ(readByte("fs-lz-full.bin.solucao", 3), bitMapBefore);
+    ASSERT_EQ(readFile("fs-lz-full.bin.solucao", "/log.txt"), small);
+
+    // Does not compress enough to fit the three direct blocks
+    std::string noise;
+    for(int i = 0; i < 60; i++){
+        noise.push_back(static_cast<char>((i * 7919) % 251));
+    }
+    ASSERT_THROW(addFile("fs-lz.bin.solucao", "/noise", noise, FileOptions{false, true}), std::runtime_error);
+    ASSERT_THROW(readFile("fs-lz.bin.solucao", "/noise"), std::runtime_error);
+}
+
+TEST(FsTest, traceLineRoundTrip){
+    TraceOp op{1700000000000000, "addFile", {"fs.bin", "/a\tb.txt", std::string("x\\y\n\0z", 6)}};
+    std::string line = traceFormat(op);
+    ASSERT_EQ(line.find('\n'), std::string::npos);
+
+    TraceOp parsed{};
+    ASSERT_TRUE(traceParse(line, parsed));
+    ASSERT_EQ(parsed.timestampUs, op.timestampUs);
+    ASSERT_EQ(parsed.op, op.op);
+    ASSERT_EQ(parsed.args, op.args);
+    ASSERT_FALSE(traceParse("12\taddFile\t\\q", parsed));
+}
+
+TEST(FsTest, directoryEntries){
+    auto paths = [](){
+        std::vector<std::string> found;
+        exportFs("fs-entries.bin.solucao", [&](const FsEntry& entry){ found.push_back(entry.path); });
+        std::sort(found.begin(), found.end());
+        return found;
+    };
+    initFs("fs-entries.bin.solucao", 2, 16, 8);
+    addDir("fs-entries.bin.solucao", "/d");
+    // The third entry needs a second entry block
+    for(auto name : {"/d/a", "/d/b", "/d/c"}){
+        addFile("fs-entries.bin.solucao", name, "x");
+    }
+    ASSERT_EQ(paths(), (std::vector<std::string>{"d", "d/a", "d/b", "d/c"}));
+
+    remove("fs-entries.bin.solucao", "/d/b");
+    ASSERT_EQ(paths(), (std::vector<std::string>{"d", "d/a", "d/c"}));
+    addFile("fs-entries.bin.solucao", "/d/e", "y");
+    ASSERT_EQ(paths(), (std::vector<std::string>{"d", "d/a", "d/c", "d/e"}));
+}
+
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
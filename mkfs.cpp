@@ -0,0 +1,96 @@
+#include "fs.h"
+#include "fs_ext.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// Type Aliases
+using str = std::string;
+namespace fsys = std::filesystem;
+
+str _readHostFile(const fsys::path& path)
+{
+	std::ifstream file{ path, std::ios::binary };
+	if(!file){
+		throw std::runtime_error("Could not open " + path.string());
+	}
+	str content{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+	if(file.bad()){
+		throw std::runtime_error("Could not read " + path.string());
+	}
+	return content;
+}
+
+FsTreeNode _scanHostTree(const fsys::path& path)
+{
+	FsTreeNode node{};
+	node.name = path.filename().string();
+	// Symlinks are not followed, the image has no way to represent them
+	auto status = fsys::symlink_status(path);
+	node.isDir = fsys::is_directory(status);
+	if(!node.isDir and !fsys::is_regular_file(status)){
+		throw std::runtime_error("Not a regular file or directory: " + path.string());
+	}
+	if(!node.isDir){
+		node.content = _readHostFile(path);
+		return node;
+	}
+	for(auto& entry : fsys::directory_iterator(path)){
+		node.children.push_back(_scanHostTree(entry.path()));
+	}
+	// Directory iteration order is unspecified, sorting keeps images reproducible
+	std::sort(node.children.begin(), node.children.end(), [](auto& a, auto& b){ return a.name < b.name; });
+	return node;
+}
+
+// Each top level entry is scanned on its own thread
+FsTreeNode _scanHostTreeParallel(const fsys::path& path)
+{
+	std::vector<fsys::path> entries{};
+	for(auto& entry : fsys::directory_iterator(path)){
+		entries.push_back(entry.path());
+	}
+	std::sort(entries.begin(), entries.end(), [](auto& a, auto& b){ return a.filename() < b.filename(); });
+
+	std::vector<std::future<FsTreeNode>> scans{};
+	for(auto& entry : entries){
+		scans.push_back(std::async(std::launch::async, _scanHostTree, entry));
+	}
+
+	FsTreeNode root{};
+	root.isDir = true;
+	for(auto& scan : scans){
+		root.children.push_back(scan.get());
+	}
+	return root;
+}
+
+int main(int argc, char **argv)
+{
+	if(argc != 5 and !(argc == 7 and str(argv[5]) == "--populate")){
+		std::cerr << "usage: " << argv[0] << " <image> <blockSize> <numBlocks> <numInodes> [--populate <dir>]" << std::endl;
+		return 1;
+	}
+
+	try {
+		str fsFileName{argv[1]};
+		int blockSize = std::stoi(argv[2]);
+		int numBlocks = std::stoi(argv[3]);
+		int numInodes = std::stoi(argv[4]);
+		if(argc == 5){
+			initFs(fsFileName, blockSize, numBlocks, numInodes);
+		} else {
+			initFs(fsFileName, blockSize, numBlocks, numInodes, _scanHostTreeParallel(argv[6]));
+		}
+	} catch(const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,229 @@
+#include "shard.h"
+#include "trace.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Type Aliases
+using u32 = uint32_t;
+using u64 = uint64_t;
+using usize = size_t;
+using str = std::string;
+using strv = std::string_view;
+
+struct Shard {
+	str fsFileName;
+	std::fstream image;
+	std::mutex mutex{};
+	std::condition_variable changed{};
+	std::deque<std::function<void()>> queue{};
+	bool done = false;
+	std::thread worker;
+};
+
+strv _topLevelName(strv path)
+{
+	usize start = path.find_first_not_of('/');
+	if(start == strv::npos){
+		return {};
+	}
+	usize end = path.find('/', start);
+	return path.substr(start, end == strv::npos ? strv::npos : end - start);
+}
+
+// FNV-1a, stable across runs and platforms unlike std::hash
+u32 _hashName(strv name)
+{
+	u32 hash = 2166136261u;
+	for(char c : name){
+		hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+	}
+	return hash;
+}
+
+size_t shardOf(const ShardMap& map, std::string_view path)
+{
+	auto name = _topLevelName(path);
+	auto pinned = map.topLevel.find(str(name));
+	if(pinned != map.topLevel.end()){
+		return pinned->second;
+	}
+	// The hash space is split in one contiguous range per shard
+	return static_cast<usize>((static_cast<u64>(_hashName(name)) * map.images.size()) >> 32);
+}
+
+template<typename Result, typename Operation>
+std::future<Result> _submit(Shard& shard, Operation operation)
+{
+	auto task = std::make_shared<std::packaged_task<Result()>>(std::move(operation));
+	auto result = task->get_future();
+	{
+		std::lock_guard<std::mutex> lock{shard.mutex};
+		shard.queue.push_back([task]{ (*task)(); });
+	}
+	shard.changed.notify_one();
+	return result;
+}
+
+void _runShard(Shard& shard)
+{
+	for(;;){
+		std::unique_lock<std::mutex> lock{shard.mutex};
+		shard.changed.wait(lock, [&]{ return shard.done or !shard.queue.empty(); });
+		if(shard.queue.empty()){
+			return;
+		}
+		auto task = std::move(shard.queue.front());
+		shard.queue.pop_front();
+		lock.unlock();
+
+		// A failed operation must not leave the stream unusable for the next ones
+		shard.image.clear();
+		task();
+		shard.image.flush();
+	}
+}
+
+ShardedFs::ShardedFs(ShardMap map) : map(std::move(map))
+{
+	// shardOf is trusted afterwards, every index it can return must be a shard
+	if(this->map.images.empty()){
+		throw std::runtime_error("Shard map has no images");
+	}
+	for(auto& [name, shard] : this->map.topLevel){
+		if(shard >= this->map.images.size()){
+			throw std::runtime_error("Shard map sends " + name + " to a missing shard");
+		}
+	}
+	for(auto& image : this->map.images){
+		auto shard = std::make_unique<Shard>();
+		shard->fsFileName = image;
+		shard->image.open(image, std::ios::binary | std::ios::in | std::ios::out);
+		if(!shard->image){
+			throw std::runtime_error("Could not open shard " + image);
+		}
+		shards.push_back(std::move(shard));
+	}
+	for(auto& shard : shards){
+		shard->worker = std::thread(_runShard, std::ref(*shard));
+	}
+}
+
+ShardedFs::~ShardedFs()
+{
+	for(auto& shard : shards){
+		{
+			std::lock_guard<std::mutex> lock{shard->mutex};
+			shard->done = true;
+		}
+		shard->changed.notify_one();
+	}
+	for(auto& shard : shards){
+		shard->worker.join();
+	}
+}
+
+std::future<void> ShardedFs::addFile(std::string path, std::string content)
+{
+	auto& shard = *shards[shardOf(map, path)];
+	return _submit<void>(shard, [&shard, path, content]{
+		traceRecord("addFile", {shard.fsFileName, path, content});
+		::addFile(shard.image, path, content);
+	});
+}
+
+std::future<void> ShardedFs::addFile(std::string path, std::string content, FileOptions options)
+{
+	auto& shard = *shards[shardOf(map, path)];
+	return _submit<void>(shard, [&shard, path, content, options]{
+		// Same encoding as the file name addFile, 'i' for inlineData and 'c' for compress
+		str traceOptions = str(options.inlineData ? "i" : "") + (options.compress ? "c" : "");
+		traceRecord("addFile", {shard.fsFileName, path, content, traceOptions});
+		::addFile(shard.image, path, content, options);
+	});
+}
+
+std::future<void> ShardedFs::addDir(std::string path)
+{
+	auto& shard = *shards[shardOf(map, path)];
+	return _submit<void>(shard, [&shard, path]{
+		traceRecord("addDir", {shard.fsFileName, path});
+		::addDir(shard.image, path);
+	});
+}
+
+std::future<void> ShardedFs::remove(std::string path)
+{
+	auto& shard = *shards[shardOf(map, path)];
+	return _submit<void>(shard, [&shard, path]{
+		traceRecord("remove", {shard.fsFileName, path});
+		::remove(shard.image, path);
+	});
+}
+
+std::future<void> ShardedFs::move(std::string oldPath, std::string newPath)
+{
+	auto from = shardOf(map, oldPath);
+	auto to = shardOf(map, newPath);
+	if(from == to){
+		auto& shard = *shards[from];
+		return _submit<void>(shard, [&shard, oldPath, newPath]{
+			traceRecord("move", {shard.fsFileName, oldPath, newPath});
+			::move(shard.image, oldPath, newPath);
+		});
+	}
+
+	// Waiting here rather than on a shard thread, two opposite moves would deadlock there
+	std::promise<void> moved{};
+	try {
+		auto& source = *shards[from];
+		auto [content, options] = _submit<std::pair<str, FileOptions>>(source, [&source, oldPath]{
+			auto content = ::readFile(source.image, oldPath);
+			return std::make_pair(content, statMany(source.image, {oldPath}).front().options);
+		}).get();
+		addFile(newPath, content, options).get();
+		try {
+			remove(oldPath).get();
+		} catch(...) {
+			// The file must not end up on both shards
+			remove(newPath).get();
+			throw;
+		}
+		moved.set_value();
+	} catch(...) {
+		moved.set_exception(std::current_exception());
+	}
+	return moved.get_future();
+}
+
+std::future<std::string> ShardedFs::readFile(std::string path)
+{
+	auto& shard = *shards[shardOf(map, path)];
+	return _submit<str>(shard, [&shard, path]{ return ::readFile(shard.image, path); });
+}
+
+std::future<std::vector<FsStat>> ShardedFs::listDir(std::string path)
+{
+	if(!_topLevelName(path).empty()){
+		auto& shard = *shards[shardOf(map, path)];
+		return _submit<std::vector<FsStat>>(shard, [&shard, path]{ return ::listDir(shard.image, path); });
+	}
+
+	std::vector<std::future<std::vector<FsStat>>> parts{};
+	for(auto& shard : shards){
+		parts.push_back(_submit<std::vector<FsStat>>(*shard, [&shard = *shard]{ return ::listDir(shard.image, "/"); }));
+	}
+	return std::async(std::launch::deferred, [parts = std::move(parts)]() mutable {
+		std::vector<FsStat> entries{};
+		for(auto& part : parts){
+			auto shardEntries = part.get();
+			entries.insert(entries.end(), shardEntries.begin(), shardEntries.end());
+		}
+		return entries;
+	});
+}
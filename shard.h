@@ -0,0 +1,61 @@
+#ifndef shard_h
+#define shard_h
+#include "fs_ext.h"
+#include <future>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * One namespace spread over several images, the shards. Each shard is a
+ * regular image created by initFs, with its own metadata, bitmap and inode table.
+ *
+ * Paths are routed by their top level component, so a directory and everything
+ * below it always live in the same shard. Top level names listed in the map go
+ * to their shard, any other name goes by the range its hash falls in.
+ */
+struct ShardMap {
+    std::vector<std::string> images;                    // one image file per shard
+    std::map<std::string, size_t> topLevel;             // pinned top level names
+};
+
+/**
+ * @brief Index, in map.images, of the shard holding path.
+ */
+size_t shardOf(const ShardMap& map, std::string_view path);
+
+struct Shard;
+
+/**
+ * Runs the operations of every shard on its own thread, with its image kept open.
+ * Calls return right away, operations on the same shard run in the order they
+ * were made and operations on different shards run in parallel. Errors are
+ * reported through the returned futures.
+ */
+class ShardedFs {
+public:
+    // Throws if map has no images or pins a name to a shard it does not have
+    explicit ShardedFs(ShardMap map);
+    // Waits for every queued operation
+    ~ShardedFs();
+
+    std::future<void> addFile(std::string path, std::string content);
+    std::future<void> addFile(std::string path, std::string content, FileOptions options);
+    std::future<void> addDir(std::string path);
+    std::future<void> remove(std::string path);
+    // A move across shards copies the file, stored with the same options, and then
+    // removes it. It is done before returning, only files can be moved that way and
+    // the copy is removed again if the original can not be.
+    std::future<void> move(std::string oldPath, std::string newPath);
+    std::future<std::string> readFile(std::string path);
+    // "/" lists the root of every shard
+    std::future<std::vector<FsStat>> listDir(std::string path);
+
+private:
+    ShardMap map;
+    std::vector<std::unique_ptr<Shard>> shards;
+};
+
+#endif /* shard_h */
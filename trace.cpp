@@ -0,0 +1,122 @@
+#include "trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+
+// Type Aliases
+using u8 = uint8_t;
+using u64 = uint64_t;
+using usize = size_t;
+using str = std::string;
+using strv = std::string_view;
+
+void _escape(str& out, strv value)
+{
+	for(char c : value){
+		u8 byte = c;
+		if(byte < 0x20 or byte > 0x7E or c == '\\' or c == '\t'){
+			char hex[5];
+			std::snprintf(hex, sizeof(hex), "\\x%02X", byte);
+			out += hex;
+		} else {
+			out.push_back(c);
+		}
+	}
+}
+
+bool _unescape(strv value, str& out)
+{
+	out.clear();
+	for(usize i = 0; i < value.size(); i++){
+		if(value[i] != '\\'){
+			out.push_back(value[i]);
+			continue;
+		}
+		if(i + 3 >= value.size() or value[i + 1] != 'x'){
+			return false;
+		}
+		str hex{value.substr(i + 2, 2)};
+		char* end = nullptr;
+		long byte = std::strtol(hex.c_str(), &end, 16);
+		if(end != hex.c_str() + 2){
+			return false;
+		}
+		out.push_back(static_cast<char>(byte));
+		i += 3;
+	}
+	return true;
+}
+
+std::string traceFormat(const TraceOp& op)
+{
+	str line = std::to_string(op.timestampUs);
+	line.push_back('\t');
+	line += op.op;
+	for(auto& arg : op.args){
+		line.push_back('\t');
+		_escape(line, arg);
+	}
+	return line;
+}
+
+bool traceParse(std::string_view line, TraceOp& op)
+{
+	std::vector<strv> fields{};
+	usize start = 0;
+	for(usize i = 0; i <= line.size(); i++){
+		if(i == line.size() or line[i] == '\t'){
+			fields.push_back(line.substr(start, i - start));
+			start = i + 1;
+		}
+	}
+	if(fields.size() < 2 or fields[0].empty() or fields[1].empty()){
+		return false;
+	}
+
+	str timestamp{fields[0]};
+	char* end = nullptr;
+	op.timestampUs = std::strtoull(timestamp.c_str(), &end, 10);
+	if(end != timestamp.c_str() + timestamp.size()){
+		return false;
+	}
+	op.op = str{fields[1]};
+	op.args.resize(fields.size() - 2);
+	for(usize i = 2; i < fields.size(); i++){
+		if(!_unescape(fields[i], op.args[i - 2])){
+			return false;
+		}
+	}
+	return true;
+}
+
+void traceRecord(std::string_view op, std::initializer_list<std::string_view> args)
+{
+	traceRecord(op, std::vector<str>(args.begin(), args.end()));
+}
+
+void traceRecord(std::string_view op, const std::vector<std::string>& args)
+{
+	// Looked up once, tracing costs a single branch when it is off
+	static const char* tracePath = std::getenv("FS_TRACE");
+	if(tracePath == nullptr){
+		return;
+	}
+
+	static std::mutex mutex{};
+	static std::ofstream trace{ tracePath, std::ios::binary | std::ios::app };
+
+	TraceOp traceOp{};
+	traceOp.timestampUs = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()
+	).count();
+	traceOp.op = str{op};
+	traceOp.args = args;
+
+	auto line = traceFormat(traceOp);
+	std::lock_guard<std::mutex> lock{mutex};
+	trace << line << '\n';
+	trace.flush();
+}
@@ -0,0 +1,48 @@
+#ifndef trace_h
+#define trace_h
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Operation traces.
+ *
+ * When the FS_TRACE environment variable names a file, every call that changes an
+ * image (initFs, addFile, addDir, remove, move, writeAt, append and resizeFs) is
+ * appended to it, one line per call. That covers the file name entry points, the
+ * requests served by fsd and the operations of ShardedFs, the stream overloads
+ * are not traced by themselves since they do not know which file they work on:
+ *   <microseconds since epoch> \t <operation> \t <argument> \t <argument> ...
+ * Arguments are escaped: '\\', '\t' and any byte outside printable ASCII are
+ * written as \xHH.
+ * An initFs that writes a directory tree adds, after its four arguments, a path
+ * and a content argument for every entry in the tree, parents before children.
+ * Directory paths end with '/' and have an empty content.
+ */
+
+struct TraceOp {
+    uint64_t timestampUs;
+    std::string op;
+    std::vector<std::string> args;  // the image file name is args[0]
+};
+
+/**
+ * @brief Appends one operation to the trace, does nothing when FS_TRACE is not set.
+ */
+void traceRecord(std::string_view op, std::initializer_list<std::string_view> args);
+void traceRecord(std::string_view op, const std::vector<std::string>& args);
+
+/**
+ * @brief Formats one trace line, without the line break.
+ */
+std::string traceFormat(const TraceOp& op);
+
+/**
+ * @brief Parses one trace line.
+ * @return false if the line is malformed
+ */
+bool traceParse(std::string_view line, TraceOp& op);
+
+#endif /* trace_h */